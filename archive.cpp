@@ -0,0 +1,120 @@
+// Created by Jeremy Cowles, 2015
+
+#include "archive.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+char const AssetArchive::Magic[8] = { 'D', 'E', 'M', 'O', 'P', 'A', 'K', '1' };
+
+AssetArchive::AssetArchive() :
+    _data(NULL),
+    _size(0),
+    _entries(NULL),
+    _count(0)
+{
+}
+
+AssetArchive::~AssetArchive()
+{
+    Close();
+}
+
+bool
+AssetArchive::Open(std::string const & path)
+{
+    Close();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 or size_t(st.st_size) < sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+
+    // The mapping outlives the descriptor
+    size_t size = size_t(st.st_size);
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    _data = static_cast<unsigned char const*>(data);
+    _size = size;
+
+    // Everything handed out later is checked here, once
+    Header const* header = reinterpret_cast<Header const*>(_data);
+    bool valid = memcmp(header->magic, Magic, sizeof(Magic)) == 0
+        and header->count <= (size - sizeof(Header)) / sizeof(Entry);
+    _entries = reinterpret_cast<Entry const*>(_data + sizeof(Header));
+    _count = valid ? header->count : 0;
+    for (uint32_t i = 0; valid and i < _count; i++) {
+        Entry const & entry = _entries[i];
+        valid = memchr(entry.name, 0, sizeof(entry.name)) != NULL
+            and entry.offset <= size and entry.size < size - entry.offset
+            and _data[entry.offset + entry.size] == 0;
+    }
+    if (not valid) {
+        std::cerr << path << ": not a valid asset archive\n";
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void
+AssetArchive::Close()
+{
+    if (_data)
+        munmap(const_cast<unsigned char*>(_data), _size);
+    _data = NULL;
+    _size = 0;
+    _entries = NULL;
+    _count = 0;
+}
+
+AssetArchive::Entry const*
+AssetArchive::_Find(std::string const & name, uint32_t kind,
+                    uint32_t channels) const
+{
+    for (uint32_t i = 0; i < _count; i++) {
+        Entry const & entry = _entries[i];
+        if (entry.kind == kind and entry.channels == channels
+            and name == entry.name)
+            return &entry;
+    }
+    return NULL;
+}
+
+bool
+AssetArchive::Find(std::string const & name, Span* span) const
+{
+    Entry const* entry = _Find(name, Raw, 0);
+    if (not entry)
+        return false;
+    span->data = _data + entry->offset;
+    span->size = size_t(entry->size);
+    return true;
+}
+
+bool
+AssetArchive::FindTexels(std::string const & name, unsigned channels,
+                         unsigned* width, unsigned* height, Span* span) const
+{
+    Entry const* entry = _Find(name, Texels, channels);
+    if (not entry
+        or entry->size != uint64_t(entry->width) * entry->height * channels)
+        return false;
+    *width = entry->width;
+    *height = entry->height;
+    span->data = _data + entry->offset;
+    span->size = size_t(entry->size);
+    return true;
+}
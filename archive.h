@@ -0,0 +1,80 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+//
+// A read-only, packed asset archive: shaders, textures and audio in one
+// file that is memory mapped at start-up, so loading an asset is an index
+// lookup returning a pointer into the mapping rather than a file read and a
+// copy. Built by tools/pack.cpp from the loose files.
+//
+// Layout, native byte order:
+//
+//   Header       magic, entry count
+//   Entry[count] the index, name plus where the data is
+//   data         every entry 16 byte aligned and followed by a NUL byte
+//                not counted in its size, so text can be used as a C string
+//
+// Besides a file's raw bytes an entry may hold pre-decoded texels for a
+// PNG, stored under the same name, so the image needs no decode at launch.
+// Texels are 8 bits per channel in lodepng's decoded layout.
+//
+class AssetArchive
+{
+public:
+    enum Kind { Raw = 0, Texels = 1 };
+
+    struct Header {
+        char magic[8];          // "DEMOPAK1"
+        uint32_t count;
+        uint32_t reserved;
+    };
+
+    struct Entry {
+        char name[64];          // NUL terminated
+        uint64_t offset;        // from the start of the file
+        uint64_t size;
+        uint32_t kind;
+        uint32_t channels;      // Texels only
+        uint32_t width;
+        uint32_t height;
+    };
+
+    struct Span {
+        unsigned char const* data;
+        size_t size;
+    };
+
+    static char const Magic[8];
+    static const size_t Alignment = 16;
+
+    AssetArchive();
+    ~AssetArchive();
+
+    // False if the file is missing or malformed, leaving the archive closed.
+    bool Open(std::string const & path);
+    void Close();
+
+    bool IsOpen() const { return _data != NULL; }
+
+    // A file's bytes, valid until Close.
+    bool Find(std::string const & name, Span* span) const;
+
+    // Pre-decoded texels of a PNG with the given channel count (1 grey,
+    // 3 RGB, 4 RGBA), valid until Close.
+    bool FindTexels(std::string const & name, unsigned channels,
+                    unsigned* width, unsigned* height, Span* span) const;
+
+private:
+    Entry const* _Find(std::string const & name, uint32_t kind,
+                       uint32_t channels) const;
+
+    unsigned char const* _data;
+    size_t _size;
+    Entry const* _entries;
+    uint32_t _count;
+};
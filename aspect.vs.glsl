@@ -2,8 +2,19 @@
 
 #version 410 core
 
-uniform vec3      iResolution;           // viewport resolution (in pixels)
-uniform sampler2D iChannel1;
+// Per-frame constants, shared by every stage; must match FrameConstants in
+// main.cpp.
+layout(std140) uniform FrameConstants {
+    vec3  iResolution;                   // render target resolution (in pixels)
+    float iGlobalTime;                   // shader playback time (in seconds)
+    vec2  iViewport;                     // output resolution (in pixels)
+    float iRandom;
+    int   iInterleave;                   // 0: off, else 1 + current field
+    vec4  iAudio;                        // kick, snare, hihat, wind
+    vec4  iTerrain;                      // heightfield origin xz, texel size, levels
+    vec4  iHistory;                      // previous frame's time, 1 if its hits are usable
+    vec4  iSunShadow;                    // world texels with a baked sun shadow, x0 z0 x1 z1
+};
 
 layout(location=0) in vec2 position;
 
@@ -14,29 +25,28 @@ out vec4 posPos;
 void main() {
     uvCoord = (position + 1)*.5;
 
-    vec2 texSize = textureSize(iChannel1, 0);
-    float widthScale = iResolution.x / texSize.x;
+    // x/y = aspect(e.g. 2.39) of the rendered image and of the screen
+    float inAspect = iResolution.x/iResolution.y;
+    float outAspect = iViewport.x/iViewport.y;
 
-    // x/y = aspect(e.g. 2.39) but below we're solving for Y
-    // so we need the reciprocal.
-    float a = 1.0/(iResolution.x/iResolution.y);
-
-    // How much black space would be on the screen if we imposed the input
-    // aspect on the output image?
-    deadSpace = (texSize.y - (texSize.x*a)) / texSize.y;
+    // The image always fills the entire width of the screen, so it covers
+    // outAspect/inAspect of the screen height. How much black space does
+    // that leave?
+    float coverage = outAspect/inAspect;
+    deadSpace = 1.0 - coverage;
 
     // Distribute dead space evenly between top and bottom of frame.
     deadSpace /= 2.0;
 
-    // The X coordinate is easy, we know we want it to fill the entire screen,
-    // so we just multiply by the widthScale. 
+    // The X coordinate is easy, the image spans the screen width.
     // 
     // The Y coordinate is tricky, because we want to scale up to the exact
     // aspect of the input image and leave variable sized black bars above and
     // below. Therefore, we first offset the local-uv-space Y by the deadspace
-    // computed above. Next, we scale that uv-coord by the widthScale.
-    uvCoord = vec2(widthScale*uvCoord.x, widthScale*(uvCoord.y - deadSpace));
-    deadSpace *= widthScale * .5*widthScale;
+    // computed above, then stretch the covered band to [0,1]. The input
+    // texture is sized to the render resolution, which may change from frame
+    // to frame, so nothing here may depend on the texture size.
+    uvCoord.y = (uvCoord.y - deadSpace) / coverage;
 
     float FXAA_SUBPIX_SHIFT = 1.0/4.0;
     vec2 rcp = 1/iResolution.xy;
@@ -17,6 +17,9 @@
 /* Mix_Music holds the music information.  */
 Mix_Music *music = NULL;
 
+/* Reads the music out of memory when it came from the asset archive.  */
+SDL_RWops *musicData = NULL;
+
 float AudioPlaybackTime = 0;
 
 void MusicDone();
@@ -27,7 +30,7 @@ void musicLengthCallback(void *udata, Uint8 *stream, int len)
     AudioPlaybackTime += len / 22050.0 / 4.0;
 }
 
-void StartAudio(void) 
+void StartAudio(void const* data, size_t size) 
 {
     // 
     // Setup audio format, rate, channels and buffers.
@@ -66,7 +69,16 @@ void StartAudio(void)
     // 
     // Load the music from source file
     //
-    music = Mix_LoadMUS("audio.ogg");
+    if (data) {
+        musicData = SDL_RWFromConstMem(data, int(size));
+#if SDL_MIXER_MAJOR_VERSION >= 2
+        music = Mix_LoadMUS_RW(musicData, 0);
+#else
+        music = Mix_LoadMUS_RW(musicData);
+#endif
+    } else {
+        music = Mix_LoadMUS("audio.ogg");
+    }
     if(!music) {
         fprintf(stderr, "Mix_LoadMUS(\"audio.ogg\"): %s\n", Mix_GetError());
         exit(1);
@@ -101,6 +113,14 @@ void SetAudioPosition(float seconds)
     Audio::Get().Update(seconds);
 }
 
+void PauseAudio(bool paused) 
+{
+    if (paused)
+        Mix_PauseMusic();
+    else
+        Mix_ResumeMusic();
+}
+
 
 //
 // SDL_mixer will call this when the music stops, we terminate the demo here
@@ -110,6 +130,9 @@ void MusicDone()
   Mix_HaltMusic();
   Mix_FreeMusic(music);
   music = NULL;
+  if (musicData)
+    SDL_FreeRW(musicData);
+  musicData = NULL;
   exit(0);
 }
 
@@ -123,6 +146,11 @@ int GetBeat(float seconds, Pattern* pat)
 {
     float beatf = TimeToBeat(seconds);
     int beat = int(beatf); // + .5);
+
+    // The timeline runs on past the end of the patterns (and may start
+    // before them)
+    if (beat < 0 or size_t(beat) >= pat->beats.size())
+        return false;
     //float delta = beat - int(beatf);
     //if (delta > .1)
     //    return false;
@@ -1,14 +1,18 @@
 #pragma once
 
 #include <bitset>
+#include <cstddef>
 #include <vector>
 
 //
 // Static audio controller methods which pass commands to SDL_mixer
 //
-void StartAudio(void);
+// Plays the Ogg Vorbis data in memory, or audio.ogg when data is NULL.
+// The data must outlive playback.
+void StartAudio(void const* data, size_t size);
 void StopAudio();
 void SetAudioPosition(float seconds);
+void PauseAudio(bool paused);
 
 //
 // Some globals describing the Beats per Minute and teh Beats per Second useful
@@ -91,6 +95,10 @@ public:
 
     void Update(float deltaSeconds);
 
+    // Puts the signals at the given time, for clients that keep their own
+    // clock rather than following playback (see Timeline).
+    void SetTime(float seconds) { _curTime = seconds; }
+
     // 
     // Discrete Event Accessors
     //   These methods return the number of events that occured since the last
@@ -0,0 +1,259 @@
+// Created by Jeremy Cowles, 2015
+
+#include "capture.h"
+
+#include "lodepng/lodepng.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+static bool
+_EndsWith(std::string const & s, std::string const & suffix)
+{
+    return s.size() >= suffix.size()
+        and s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+FrameCapture::FrameCapture() :
+    _open(false),
+    _lossless(false),
+    _y4m(false),
+    _y4mFile(NULL),
+    _width(0),
+    _height(0),
+    _next(0),
+    _dropped(0),
+    _closing(false)
+{
+    for (int i = 0; i < Depth; i++) {
+        _slots[i].pbo = 0;
+        _slots[i].fence = 0;
+        _slots[i].frame = 0;
+    }
+}
+
+FrameCapture::~FrameCapture()
+{
+    Close();
+}
+
+bool
+FrameCapture::Open(std::string const & path, int width, int height,
+                   double fps, bool lossless)
+{
+    _path = path;
+    _width = width;
+    _height = height;
+    _lossless = lossless;
+    _y4m = _EndsWith(path, ".y4m");
+
+    if (_y4m) {
+        _y4mFile = fopen(path.c_str(), "wb");
+        if (not _y4mFile) {
+            std::cerr << "Failed to open " << path << " for writing\n";
+            return false;
+        }
+        // Studio range BT.601 without chroma subsampling, see _WriteY4m
+        fprintf(_y4mFile, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C444\n",
+                width, height, int(std::floor(fps*1000 + 0.5)));
+    }
+
+    GLsizeiptr size = GLsizeiptr(width)*height*4;
+    for (int i = 0; i < Depth; i++) {
+        glGenBuffers(1, &_slots[i].pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _slots[i].pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    _next = 0;
+    _dropped = 0;
+    _closing = false;
+    _open = true;
+    _thread = std::thread(&FrameCapture::_Run, this);
+    return true;
+}
+
+void
+FrameCapture::Capture(size_t frame)
+{
+    if (not _open)
+        return;
+
+    // Collect whatever the GPU has finished, oldest first. Fences signal in
+    // order, so the first one still pending means the rest are too.
+    for (int i = 0; i < Depth; i++) {
+        _Slot* slot = &_slots[(_next + i) % Depth];
+        if (slot->fence and not _Harvest(slot, false))
+            break;
+    }
+
+    _Slot* slot = &_slots[_next];
+    if (slot->fence) {
+        if (not _lossless) {
+            _dropped++;
+            return;
+        }
+        _Harvest(slot, true);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->frame = frame;
+    _next = (_next + 1) % Depth;
+}
+
+bool
+FrameCapture::_Harvest(_Slot* slot, bool wait)
+{
+    // The flush makes sure the fence reaches the GPU and can signal at all.
+    GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                     0);
+    while (wait and status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(slot->fence, 0, 1000000);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+    glDeleteSync(slot->fence);
+    slot->fence = 0;
+
+    _Frame frame;
+    frame.index = slot->frame;
+    frame.pixels.resize(size_t(_width)*_height*4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                  frame.pixels.size(), GL_MAP_READ_BIT);
+    if (data)
+        memcpy(&frame.pixels[0], data, frame.pixels.size());
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (not data) {
+        _dropped++;
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_queue.size() >= size_t(MaxQueued)) {
+        if (not _lossless) {
+            _dropped++;
+            return true;
+        }
+        _space.wait(lock, [this]() {
+            return _queue.size() < size_t(MaxQueued);
+        });
+    }
+    _queue.push_back(_Frame());
+    _queue.back().index = frame.index;
+    _queue.back().pixels.swap(frame.pixels);
+    _wake.notify_one();
+    return true;
+}
+
+void
+FrameCapture::Close()
+{
+    if (not _open)
+        return;
+
+    // Shutting down may wait, the frames in flight are still wanted.
+    for (int i = 0; i < Depth; i++) {
+        _Slot* slot = &_slots[(_next + i) % Depth];
+        if (slot->fence)
+            _Harvest(slot, true);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closing = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+
+    for (int i = 0; i < Depth; i++) {
+        glDeleteBuffers(1, &_slots[i].pbo);
+        _slots[i].pbo = 0;
+    }
+    if (_y4mFile)
+        fclose(_y4mFile);
+    _y4mFile = NULL;
+    _open = false;
+
+    if (_dropped)
+        std::cerr << "Capture dropped " << _dropped << " frames\n";
+}
+
+void
+FrameCapture::_Run()
+{
+    for (;;) {
+        _Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this]() {
+                return _closing or not _queue.empty();
+            });
+            if (_queue.empty())
+                return;
+            frame.index = _queue.front().index;
+            frame.pixels.swap(_queue.front().pixels);
+            _queue.pop_front();
+        }
+        _space.notify_one();
+        _Encode(frame);
+    }
+}
+
+void
+FrameCapture::_Encode(_Frame const & frame)
+{
+    // GL origin is bottom-left, both outputs are top-left.
+    std::vector<unsigned char> image(frame.pixels.size());
+    size_t rowSize = size_t(_width)*4;
+    for (int y = 0; y < _height; y++) {
+        std::copy(frame.pixels.begin() + (_height - 1 - y)*rowSize,
+                  frame.pixels.begin() + (_height - y)*rowSize,
+                  image.begin() + y*rowSize);
+    }
+
+    if (_y4m)
+        _WriteY4m(image);
+    else
+        _WritePng(frame, image);
+}
+
+void
+FrameCapture::_WritePng(_Frame const & frame,
+                        std::vector<unsigned char> const & image)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%05d.png", int(frame.index));
+    unsigned error = lodepng::encode(_path + suffix, image, _width, _height);
+    if (error) {
+        std::cerr << "encoder error " << error << ": "
+                  << lodepng_error_text(error) << std::endl;
+    }
+}
+
+void
+FrameCapture::_WriteY4m(std::vector<unsigned char> const & image)
+{
+    // Integer BT.601, the range players assume for Y4M without a tag.
+    size_t count = size_t(_width)*_height;
+    std::vector<unsigned char> planes(count*3);
+    unsigned char* yp = &planes[0];
+    unsigned char* up = yp + count;
+    unsigned char* vp = up + count;
+    for (size_t i = 0; i < count; i++) {
+        int r = image[4*i], g = image[4*i + 1], b = image[4*i + 2];
+        yp[i] = (( 66*r + 129*g +  25*b + 128) >> 8) + 16;
+        up[i] = ((-38*r -  74*g + 112*b + 128) >> 8) + 128;
+        vp[i] = ((112*r -  94*g -  18*b + 128) >> 8) + 128;
+    }
+    fputs("FRAME\n", _y4mFile);
+    fwrite(&planes[0], 1, planes.size(), _y4mFile);
+}
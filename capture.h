@@ -0,0 +1,91 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Records the default framebuffer without stalling the render loop.
+//
+// Each captured frame is read into one of a small ring of pixel buffer
+// objects, which the GPU fills asynchronously. A fence marks when the copy is
+// done; later frames check the fence without waiting, map the finished
+// buffers and hand the pixels to a worker thread, which does the vertical
+// flip and the encoding. A path ending in .y4m is written as a single
+// uncompressed YUV4MPEG2 (4:4:4) stream, anything else is used as a prefix
+// for one PNG per frame.
+//
+// A live recording (lossless == false) drops frames instead of waiting when
+// readback or encoding falls behind; offline renders set lossless so every
+// frame is kept, waiting only when the whole ring is still in flight.
+//
+class FrameCapture
+{
+public:
+    static const int Depth = 3;
+
+    // Frames allowed to queue up for the encoder before capture either drops
+    // frames or waits for it.
+    static const int MaxQueued = 8;
+
+    FrameCapture();
+    ~FrameCapture();
+
+    // Requires a current GL context, fps is only used for the Y4M header.
+    bool Open(std::string const & path, int width, int height, double fps,
+              bool lossless);
+
+    // Queues a readback of the frame just rendered, call before swapping.
+    void Capture(size_t frame);
+
+    // Waits for all outstanding frames to be encoded and closes the output.
+    void Close();
+
+    bool IsOpen() const { return _open; }
+    size_t GetDropped() const { return _dropped; }
+
+private:
+    struct _Slot {
+        GLuint pbo;
+        GLsync fence;
+        size_t frame;
+    };
+
+    struct _Frame {
+        size_t index;
+        std::vector<unsigned char> pixels;
+    };
+
+    bool _Harvest(_Slot* slot, bool wait);
+    void _Run();
+    void _Encode(_Frame const & frame);
+    void _WritePng(_Frame const & frame, std::vector<unsigned char> const & image);
+    void _WriteY4m(std::vector<unsigned char> const & image);
+
+    bool _open;
+    bool _lossless;
+    std::string _path;
+    bool _y4m;
+    FILE* _y4mFile;
+    int _width;
+    int _height;
+
+    _Slot _slots[Depth];
+    int _next;
+    size_t _dropped;
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _space;
+    std::deque<_Frame> _queue;
+    bool _closing;
+};
@@ -6,13 +6,40 @@
 
 in vec4 fragColor;
 in vec2 uvCoord;
-out vec4 color;
-uniform float     iRandom;
-uniform vec3      iResolution;           // viewport resolution (in pixels)
-uniform float     iGlobalTime;           // shader playback time (in seconds)
+layout(location = 0) out vec4 color;
+layout(location = 1) out float hitDistance;  // t of the shade pass, for warmStart
 //uniform vec4      iMouse;                // mouse pixel coords. xy: current (if MLB down), zw: click
 uniform sampler2D iChannel0;
-uniform sampler2D iChannel1;
+uniform sampler2D iChannel1;             // cone depth pre-pass
+uniform sampler2D iChannel2;             // previous frame's hitDistance
+uniform sampler2D iChannel3;             // heightfield max pyramid
+uniform sampler2D iChannel4;             // baked sun shadow
+
+// What this draw does, must match the pass enum in main.cpp
+uniform int iPass;
+const int ShadePass = 0;                 // the image
+const int BakeHeightsPass = 1;           // desert() into heightfield level 0
+const int ReduceHeightsPass = 2;         // max of 2x2 texels of the level below
+const int ConeDepthPass = 3;             // coneDepth per tile of the image
+const int BakeShadowPass = 4;            // softShadow of the terrain, per heightfield texel
+
+// Pixels across each tile of the cone depth pre-pass, must match _ConeTile
+// in main.cpp.
+const float coneTile = 4.0;
+
+// Per-frame constants, shared by every stage; must match FrameConstants in
+// main.cpp.
+layout(std140) uniform FrameConstants {
+    vec3  iResolution;                   // render target resolution (in pixels)
+    float iGlobalTime;                   // shader playback time (in seconds)
+    vec2  iViewport;                     // output resolution (in pixels)
+    float iRandom;
+    int   iInterleave;                   // 0: off, else 1 + current field
+    vec4  iAudio;                        // kick, snare, hihat, wind
+    vec4  iTerrain;                      // heightfield origin xz, texel size, levels
+    vec4  iHistory;                      // previous frame's time, 1 if its hits are usable
+    vec4  iSunShadow;                    // world texels with a baked sun shadow, x0 z0 x1 z1
+};
 
 // value noise, and its analytical derivatives
 vec3 noised( in vec2 x )
@@ -48,37 +75,73 @@ float usin(float x) {
     return sin(x) + 1.0;
 }
 
+// The sun
+const vec3 light1 = normalize( vec3(-0.8,0.4,-2.0) );
+
 float udBox( in vec3 p, in vec3 b )
 {
 	// From iquilezles.com
     return length(max(abs(p)-b,0.0));
 }
 
-float desert( in vec2 x)
+// Slope of smoothstep(e0, e1, x).
+float dsmoothstep( in float e0, in float e1, in float x )
+{
+    float u = clamp((x - e0)/(e1 - e0), 0.0, 1.0);
+    return 6.0*u*(1.0 - u)/(e1 - e0);
+}
+
+//
+// The terrain's height (.x) and its gradient (.yz, along x and z) from one
+// evaluation, carrying noised's derivatives through every term. Where only
+// the height is used, the compiler drops the rest, see desert.
+//
+vec3 desertd( in vec2 x )
 {
     vec3 n01 = noised(x*.01);
+    vec2 dn01 = .01*n01.yz;
     vec2 xx = x;
     xx.y += 100.*n01.x    ;
         //- iGlobalTime*50.
         //+ n01.z*10.; // Dune evolution, movement
-    
+    vec2 dxxy = vec2(0.,1.) + 100.*dn01;
+
+    // FNs only jumps where its sine is 0, so the floor has no slope
+    float a1 = FN + (x.x*.005+x.y*.0001);
+    vec3 n02 = noised(x*.005);
     float dunes = sin(FNs) * 100.
-                + sin(FN + (x.x*.005+x.y*.0001)) * 30. 
-                + 20.*noised(x*.005).x;
+                + sin(a1) * 30. 
+                + 20.*n02.x;
+    vec2 ddunes = cos(FNs) * 100. * .005*dxxy
+                + cos(a1) * 30. * vec2(.005, .0051)
+                + 20.*.005*n02.yz;
     
-    float ripples = sin(FN2) * (noised(x*.01).x*(dunes/150.));
+    // noised(x*.01) again, as n01
+    float ripples = sin(FN2) * (n01.x*(dunes/150.));
+    vec2 dFN2 = vec2(cos(x.x*.015)*.15, 1.);
+    vec2 dripples = cos(FN2)*dFN2 * (n01.x*(dunes/150.))
+                  + sin(FN2) * (dn01*dunes + n01.x*ddunes)/150.;
     
     dunes += ripples;
-    dunes *= sin(FN + (x.x*.01+x.y*.0001))*.25+.75;
+    ddunes += dripples;
+    float a2 = FN + (x.x*.01+x.y*.0001);
+    float scale = sin(a2)*.25+.75;
+    ddunes = ddunes*scale + dunes*cos(a2)*.25*vec2(.01, .0051);
+    dunes *= scale;
     float flt = .001*dunes;
     
-    return mix(dunes, flt, smoothstep(-2000., 100., x.y)) +
-           mix(flt, dunes, smoothstep(300., 1000., x.y));
+    // Both mixes are dunes times a weight that only varies along z
+    float s1 = smoothstep(-2000., 100., x.y);
+    float s2 = smoothstep(300., 1000., x.y);
+    float w = mix(1., .001, s1) + mix(.001, 1., s2);
+    float dw = .999*(dsmoothstep(300., 1000., x.y) - dsmoothstep(-2000., 100., x.y));
+    return vec3(mix(dunes, flt, s1) + mix(flt, dunes, s2),
+                ddunes*w + vec2(0., dunes*dw));
 }
 
-float desert2( in vec2 x)
+float desert( in vec2 x)
 {
-	return desert(x);
+    return desertd(x).x;
 }
 
 float map( in vec3 p )
@@ -132,12 +195,98 @@ float city( in vec3 p )
 	return udBox(p, b);
 }
 
+//
+// Bound on desert()'s slope, from the terms of desertd with noised's
+// derivatives at their most (1.5 per axis) and the noise at 0 or 1: the
+// dunes 1.89, ripples 1.05, the z scale 0.42 and the far blend 0.32.
+// Sampled slopes stay under 1.4, but nothing guarantees that.
+//
+const float terrainSlope = 3.7;
+
+// Heightfield texels sample desert() at their centers; this much (in texels)
+// on top of a cell's max covers the terrain anywhere inside it, no point
+// being more than half a texel's diagonal from a center.
+const float terrainMargin = terrainSlope*sqrt(0.5);
+
+// No roof in city() is higher than this: b.y there is at most 13 + 10*1.5,
+// n01.y being a noise derivative.
+const float cityTop = -22.0;
+
+// Clearance above which marching hands over to the pyramid again.
+const float skipClearance = 20.0;
+
+//
+// Advances t along the ray to where it may come within reach of the terrain
+// or the city, by walking the heightfield pyramid: cells the ray passes over
+// entirely are stepped over whole, moving to coarser levels while that
+// works and finer ones when it doesn't, down to single texels. Returns
+// something past tend if nothing is in reach before it, and stops early at
+// the edge of the heightfield, outside of which the caller marches on its
+// own.
+//
+// "Reach" is the caller's: anything closer than pad + slope*t to the ray
+// counts, e.g. the hit tolerance of intersect, so skipping never jumps over
+// a point where marching would have stopped.
+//
+float skipEmptySpace( in vec3 ro, in vec3 rd, in float t, in float tend,
+                      in float pad, in float slope )
+{
+    float texel = iTerrain.z;
+    int top = int(iTerrain.w) - 1;
+    float size = float(1 << top);
+
+    // In texels from the heightfield's corner, where precision is good
+    vec2 o = (ro.xz - iTerrain.xy) / texel;
+    vec2 d = rd.xz / texel;
+    d = mix(vec2(1e-6), d, greaterThan(abs(d), vec2(1e-6)));
+    vec2 invD = 1.0 / d;
+    vec2 ahead = step(0.0, d);
+    vec2 nudge = (2.0*ahead - 1.0) * 0.01;
+
+    int level = top;
+    for( int i=0; i<64 && t<=tend; i++ )
+    {
+        vec2 q = o + t*d + nudge;
+        if( any(lessThan(q, vec2(0.0))) || any(greaterThanEqual(q, vec2(size))) )
+            break;
+
+        float cellSize = float(1 << level);
+        vec2 cell = floor(q / cellSize);
+        vec2 tb = ((cell + ahead)*cellSize - o) * invD;
+        float texit = min(tb.x, tb.y);
+
+        float ceiling = max(texelFetch(iChannel3, ivec2(cell), level).x
+                            + terrainMargin*texel, cityTop);
+        float bound = ceiling + pad + slope*texit;
+        float y = ro.y + t*rd.y;
+        float yexit = ro.y + texit*rd.y;
+
+        if( min(y, yexit) > bound )
+        {
+            // Over the whole cell
+            t = texit;
+            level = min(level + 1, top);
+        }
+        else
+        {
+            // Descends into the cell, down to the bound first
+            if( y > bound ) t = (bound - ro.y) / rd.y;
+            if( level == 0 ) break;
+            level--;
+        }
+    }
+    return t;
+}
+
 float intersect( in vec3 ro, in vec3 rd, in float tmin, in float tmax, out int prim )
 {
-    float t = tmin;
+    float t = skipEmptySpace( ro, rd, tmin, tmax, 0.0, 0.002 );
     prim = -1;
 	for( int i=0; i<120; i++ )
 	{
+        // Hits past tmax show as sky anyway
+        if (t > tmax) break;
+
         vec3 p = ro + t*rd;
 		float h = map(p);
         if( h<(0.002*t) ) { prim = 0; break; }
@@ -145,20 +294,53 @@ float intersect( in vec3 ro, in vec3 rd, in float tmin, in float tmax, out int p
         float hh = city(p);
         if( hh<(0.002*t) ) { prim = 1; break; }
         
-        // prim = -1
-        if (t > tmax) break;
-        
 		t += 0.5*min(h,hh);
+        if( min(h,hh) > skipClearance )
+            t = skipEmptySpace( ro, rd, t, tmax, 0.0, 0.002 );
 	}
 
 	return t;
 }
 
+//
+// Marches a cone around the ray instead of the ray itself, spread being the
+// distance from its axis to its edge per unit t, and returns how far the
+// whole cone is clear of the terrain and the city, hit tolerance included:
+// any ray inside it can start intersect there rather than at tmin, and will
+// find the same hit.
+//
+float coneDepth( in vec3 ro, in vec3 rd, in float spread, in float tmin, in float tmax )
+{
+    // Skipping only looks at the heights under the axis; the terrain under
+    // the rest of the cone is at most terrainSlope times as far higher.
+    float k = spread + 0.002;
+    float skipSlope = spread*(1.0 + terrainSlope) + 0.002;
+    float t = skipEmptySpace( ro, rd, tmin, tmax, 0.0, skipSlope );
+
+    // Kept short: near the terrain the steps shrink as the cone grazes it,
+    // and the rays do better marching that part themselves.
+    for( int i=0; i<16 && t<=tmax; i++ )
+    {
+        // Both are at most twice the true distance, see intersect
+        vec3 p = ro + t*rd;
+        float d = 0.5*min( map(p), city(p) );
+        if( d < k*t ) break;
+
+        // Furthest the cone's cross-section stays inside the free sphere
+        t += (d - k*t)/(1.0 + k);
+        if( d > skipClearance )
+            t = skipEmptySpace( ro, rd, t, tmax, 0.0, skipSlope );
+    }
+    return t;
+}
+
 float softShadow(in vec3 ro, in vec3 rd )
 {
     // real shadows	
     float res = 1.0;
-    float t = .001;
+    // Only skips where neither term below could lower res
+    float tend = rd.y > 0.0 ? (200.0 - ro.y)/rd.y : 1e10;
+    float t = skipEmptySpace( ro, rd, .001, tend, 1.0, 1.0/16.0 );
 	for( int i=0; i<128; i++ )
 	{
 	    vec3  p = ro + t*rd;
@@ -171,16 +353,51 @@ float softShadow(in vec3 ro, in vec3 rd )
 		if( res<0.001 ||p.y>200.0 ) break;
         
        	t += min(hh,h);
+        if( min(hh,h) > skipClearance )
+            t = skipEmptySpace( ro, rd, t, tend, 1.0, 1.0/16.0 );
 	}
 	return clamp( res, 0.0, 1.0 );
 }
 
+//
+// Sun visibility at a hit: on the sand, the baked softShadow around it
+// where the bake has got to, see iChannel4. The texture holds the texel
+// centers' values, so only points between four baked centers can filter.
+//
+float sunShadow( in vec3 pos, int prim )
+{
+    vec2 u = pos.xz / iTerrain.z;
+    if( prim == 0 && all(greaterThanEqual(u, iSunShadow.xy + 0.5))
+                  && all(lessThan(u, iSunShadow.zw - 0.5)) )
+    {
+        float size = float(1 << (int(iTerrain.w) - 1));
+        return textureLod( iChannel4, u/size, 0.0 ).x;
+    }
+    return softShadow( pos+light1*20.0, light1 );
+}
+
 vec3 sandNormal( in vec3 pos, float t )
 {
-    vec2  eps = vec2( 0.002*t, 0.0 );
-    return normalize( vec3( desert2(pos.xz-eps.xy) - desert2(pos.xz+eps.xy),
+    vec2 g = desertd(pos.xz).yz;
+    return normalize( vec3( -g.x, 1.0, -g.y ) );
+}
+
+//
+// 1 shades the sand by how far sandNormal is from central differences:
+// black where they agree, full red at 5 degrees or more. The step is small
+// to catch mistakes in desertd rather than the smoothing of the wider
+// steps sandNormal used to take, but grows with the coordinates so float
+// precision doesn't swamp it; GPU sines still leave a faint speckle.
+// Expect red only along the dunes' creases.
+//
+#define CHECK_SAND_NORMALS 0
+
+vec3 sandNormalDifferences( in vec3 pos )
+{
+    vec2  eps = vec2( 0.01*max(1.0, max(abs(pos.x), abs(pos.z))/1000.0), 0.0 );
+    return normalize( vec3( desert(pos.xz-eps.xy) - desert(pos.xz+eps.xy),
                             2.0*eps.x,
-                            desert2(pos.xz-eps.yx) - desert2(pos.xz+eps.yx) ) );
+                            desert(pos.xz-eps.yx) - desert(pos.xz+eps.yx) ) );
 }
 
 vec3 cityNormal( in vec3 pos, float t )
@@ -204,6 +421,73 @@ vec3 camPath( float time )
 	return vec3( time * 1500., sin(time*10.)*30.+30., time * 1000.);
 }
 
+// Camera position and basis at the given iGlobalTime.
+void camera( in float globalTime, out vec3 ro, out vec3 cu, out vec3 cv, out vec3 cw )
+{
+    //float time = iGlobalTime*0.15 + 0.3 + 4.0*iMouse.x/iResolution.x;
+    float time = globalTime*0.15 + 0.3 + 4.0/iResolution.x;
+
+    // camera position
+	ro = vec3(0); ro = camPath(time);
+	vec3 ta = vec3(100,0,0); ta = camPath( time + 3.0 );
+	//ro.y = desert( ro.xz ) + 110.0;
+    ro.y = max(ro.y, desert(ro.xz)+10.0);
+	ta.y = ro.y - 20.0;
+	float cr = 0.2*cos(0.1*time);
+
+	cw = normalize(ta-ro);
+	vec3  cp = vec3(sin(cr), cos(cr),0.0);
+	cu = normalize( cross(cw,cp) );
+	cv = normalize( cross(cu,cw) );
+}
+
+// Ray through the given pixel position.
+vec3 cameraRay( in vec2 fragCoord, in vec3 cu, in vec3 cv, in vec3 cw )
+{
+    vec2 xy = -1.0 + 2.0*fragCoord/iResolution.xy;
+	vec2 s = xy*vec2(iResolution.x/iResolution.y,1.0);
+	return normalize( s.x*cu + s.y*cv + 2.0*cw );
+}
+
+// Fraction of the distance to last frame's hit the ray may skip.
+const float warmMargin = 0.9;
+
+//
+// Temporal warm start: where the ray can start marching, going by what the
+// previous frame hit around the same point. This pixel's previous distance
+// gives a rough point along the ray, which is projected into the previous
+// image; the nearest of the hits around it there, less a margin, is
+// taken as empty. Returns tmin when the previous frame has nothing to say:
+// unusable history, points behind it or off its screen, or a start that
+// would already be on a surface, where the history has gone stale.
+//
+float warmStart( in vec3 ro, in vec3 rd, in float tmin )
+{
+    if (iHistory.y == 0.0) return tmin;
+
+    vec3 pro, pcu, pcv, pcw;
+    camera( iHistory.x, pro, pcu, pcv, pcw );
+
+    float guess = texelFetch(iChannel2, ivec2(gl_FragCoord.xy), 0).x;
+    vec3 d = ro + guess*rd - pro;
+    float z = dot(d, pcw);
+    if( z <= 0.0 ) return tmin;
+
+    // Inverse of cameraRay
+    vec2 s = 2.0*vec2(dot(d, pcu), dot(d, pcv))/z;
+    vec2 uv = 0.5 + 0.5*s/vec2(iResolution.x/iResolution.y, 1.0);
+    if( any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))) )
+        return tmin;
+
+    vec4 near = textureGather(iChannel2, uv, 0);
+    float last = min(min(near.x, near.y), min(near.z, near.w));
+    float t = warmMargin*length(pro + last*normalize(d) - ro);
+
+    vec3 p = ro + t*rd;
+    if( min(map(p), city(p)) < 0.002*t ) return tmin;
+    return max(tmin, t);
+}
+
 float fbm( vec2 p )
 {
     float f = 0.0;
@@ -218,28 +502,63 @@ float fbm( vec2 p )
 
 void main( void )
 {
-    vec2 xy = -1.0 + 2.0*gl_FragCoord.xy/iResolution.xy;
-	vec2 s = xy*vec2(iResolution.x/iResolution.y,1.0);
-	
-    //float time = iGlobalTime*0.15 + 0.3 + 4.0*iMouse.x/iResolution.x;
-    float time = iGlobalTime*0.15 + 0.3 + 4.0/iResolution.x;
-	
-	vec3 light1 = normalize( vec3(-0.8,0.4,-2.0) );
+    // Heightfield bake, see skipEmptySpace
+    if (iPass == BakeHeightsPass) {
+        color = vec4(desert(iTerrain.xy + gl_FragCoord.xy*iTerrain.z));
+        return;
+    }
+    if (iPass == ReduceHeightsPass) {
+        // Only the level below is visible, as level 0
+        ivec2 p = 2*ivec2(gl_FragCoord.xy);
+        color = vec4(max(max(texelFetch(iChannel3, p, 0).x,
+                             texelFetch(iChannel3, p + ivec2(1,0), 0).x),
+                         max(texelFetch(iChannel3, p + ivec2(0,1), 0).x,
+                             texelFetch(iChannel3, p + ivec2(1,1), 0).x)));
+        return;
+    }
 
-    // camera position
-	vec3 ro = vec3(0); ro = camPath(time);
-	vec3 ta = vec3(100,0,0); ta = camPath( time + 3.0 );
-	//ro.y = desert( ro.xz ) + 110.0;
-    ro.y = max(ro.y, desert(ro.xz)+10.0);
-	ta.y = ro.y - 20.0;
-	float cr = 0.2*cos(0.1*time);
+    if (iPass == BakeShadowPass) {
+        // The texture wraps around, so its texel is the one of the tile's
+        // that falls on it
+        float texel = iTerrain.z;
+        float size = float(1 << (int(iTerrain.w) - 1));
+        vec2 origin = iTerrain.xy / texel;
+        vec2 w = origin + mod(floor(gl_FragCoord.xy) - origin, size);
+        vec2 xz = (w + 0.5)*texel;
+        vec3 pos = vec3(xz.x, desert(xz), xz.y);
+        color = vec4(softShadow( pos+light1*20.0, light1 ));
+        return;
+    }
+
+    vec3 ro, cu, cv, cw;
+    camera( iGlobalTime, ro, cu, cv, cw );
+
+    if (iPass == ConeDepthPass) {
+        // A cone around the ray through the tile's center holds the rays of
+        // all its pixels: on the image plane, which is at least 2.0 away,
+        // they are within the tile's half diagonal of it (in the units of s,
+        // see cameraRay).
+        vec2 center = (floor(gl_FragCoord.xy) + 0.5)*coneTile;
+        vec3 rd = cameraRay( center, cu, cv, cw );
+        float spread = 0.5*coneTile*sqrt(2.0)/iResolution.y;
+        color = vec4(coneDepth( ro, rd, spread, 10.0, 2000.0 ));
+        return;
+    }
 
+    // Interleaved rendering shades one field of a checkerboard per frame,
+    // the film pass fills in the other field from the previous frame. The
+    // checkerboard is made of 2x2 blocks so whole quads are discarded
+    // together, otherwise the rest of each quad still pays for the march.
+    if (iInterleave != 0) {
+        ivec2 block = ivec2(gl_FragCoord.xy) / 2;
+        if (((block.x + block.y) & 1) != iInterleave - 1)
+            discard;
+    }
+
+    vec2 xy = -1.0 + 2.0*gl_FragCoord.xy/iResolution.xy;
+	
     // camera ray    
-	vec3  cw = normalize(ta-ro);
-	vec3  cp = vec3(sin(cr), cos(cr),0.0);
-	vec3  cu = normalize( cross(cw,cp) );
-	vec3  cv = normalize( cross(cu,cw) );
-	vec3  rd = normalize( s.x*cu + s.y*cv + 2.0*cw );
+	vec3  rd = cameraRay( gl_FragCoord.xy, cu, cv, cw );
     
     // bounding plane
     float tmin = 10.0;
@@ -252,10 +571,15 @@ void main( void )
         else            tmax = min( tmax, tp );
     }
 
+    // Every ray of the tile is clear up to the pre-pass's distance
+    tmin = max( tmin, texelFetch(iChannel1, ivec2(gl_FragCoord.xy/coneTile), 0).x );
+    tmin = warmStart( ro, rd, tmin );
+
 	float sundot = clamp(dot(rd,light1),0.0,1.0);
 	vec3 col;
     int prim;
     float t = intersect( ro, rd, tmin, tmax, prim );
+    hitDistance = min( t, 2000.0 );
 
     vec3 darkBlue = vec3(0.169, 0.31, 0.6);
     vec3 lightBlue = vec3(0.769, 0.843, 0.918);
@@ -303,7 +627,7 @@ void main( void )
         float amb = clamp(0.5+0.5*nor.y,0.0,1.0);
 		float dif = clamp( dot( light1, nor ), 0.0, 1.0 );
 		float bac = clamp( 0.2 + 0.8*dot( normalize( vec3(-light1.x, 0.0, light1.z ) ), nor ), 0.0, 1.0 );
-		float sh = 1.0; if( dif>=0.0001 ) sh = softShadow(pos+light1*20.0,light1);
+		float sh = 1.0; if( dif>=0.0001 ) sh = sunShadow(pos, prim);
 		
 		vec3 lin  = vec3(0.0);
 		lin += dif*vec3(7.00,5.00,3.00)*vec3( sh, sh*sh*0.5+0.5*sh, sh*sh*0.8+0.2*sh );
@@ -330,6 +654,15 @@ void main( void )
 		col += 0.3*vec3(1.0,0.8,0.4)*pow( sundot, 8.0 )*(1.0-exp(-0.002*t));
 	}
 
+    #if CHECK_SAND_NORMALS
+    if( t<=tmax && prim==0 )
+    {
+        vec3 pos = ro + t*rd;
+        float c = dot( sandNormal(pos, t), sandNormalDifferences(pos) );
+        col = vec3( clamp(degrees(acos(clamp(c, -1.0, 1.0)))/5.0, 0.0, 1.0), 0.0, 0.0 );
+    }
+    #endif
+
     // gamma
 	col = pow(col,vec3(0.4545));
 
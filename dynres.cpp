@@ -0,0 +1,71 @@
+// Created by Jeremy Cowles, 2015
+
+#include "dynres.h"
+
+// Fresh samples required before the level may change again
+static const int _SettleFrames = 8;
+
+// Weight of a new sample in the moving averages
+static const double _Smoothing = 0.25;
+
+// Only scale up when the larger level is predicted to fit with some slack,
+// otherwise we bounce between two levels.
+static const double _Headroom = 0.85;
+
+ResolutionController::ResolutionController(std::vector<double> const & pixels,
+                                           double budgetMs) :
+    _pixels(pixels),
+    _budgetMs(budgetMs),
+    _level(0),
+    _changeFrame(0),
+    _scaledMs(0),
+    _fixedMs(0),
+    _samples(0)
+{
+}
+
+void
+ResolutionController::AddGpuFrame(size_t frameIndex, double scaledMs,
+                                  double fixedMs)
+{
+    // Rendered at the previous level, says nothing about the current one
+    if (frameIndex < _changeFrame)
+        return;
+
+    if (_samples == 0) {
+        _scaledMs = scaledMs;
+        _fixedMs = fixedMs;
+    } else {
+        _scaledMs += _Smoothing * (scaledMs - _scaledMs);
+        _fixedMs += _Smoothing * (fixedMs - _fixedMs);
+    }
+    _samples++;
+}
+
+int
+ResolutionController::Update(size_t frameIndex)
+{
+    if (_samples < _SettleFrames)
+        return _level;
+
+    int last = int(_pixels.size()) - 1;
+    if (_scaledMs + _fixedMs > _budgetMs) {
+        if (_level < last)
+            _SetLevel(_level + 1, frameIndex);
+    } else if (_level > 0) {
+        // The scaled part of the frame is dominated by per-pixel work, so
+        // predict the larger level's cost from the ratio of pixel counts.
+        double ratio = _pixels[_level - 1] / _pixels[_level];
+        if (_scaledMs * ratio + _fixedMs < _budgetMs * _Headroom)
+            _SetLevel(_level - 1, frameIndex);
+    }
+    return _level;
+}
+
+void
+ResolutionController::_SetLevel(int level, size_t frameIndex)
+{
+    _level = level;
+    _changeFrame = frameIndex;
+    _samples = 0;
+}
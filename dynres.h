@@ -0,0 +1,49 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+//
+// Picks a render scale level each frame to hold the GPU frame time under a
+// budget. Levels are ordered largest first and are expected to be
+// pre-allocated by the caller, so a level change is just a different target.
+//
+// GPU timings arrive several frames late, so samples from frames rendered
+// before the last level change are discarded and the controller waits for
+// a few fresh samples before deciding again. This keeps it from oscillating.
+//
+class ResolutionController
+{
+public:
+    // pixels holds the pixel count of each level, largest first
+    ResolutionController(std::vector<double> const & pixels,
+                         double budgetMs);
+
+    //
+    // Feeds the GPU time of a resolved frame, split into the part that
+    // scales with render resolution and the part that doesn't (e.g. the
+    // composite at screen resolution).
+    //
+    void AddGpuFrame(size_t frameIndex, double scaledMs, double fixedMs);
+
+    // Returns the level to render the given frame at, possibly switching.
+    int Update(size_t frameIndex);
+
+    int GetLevel() const { return _level; }
+
+private:
+    void _SetLevel(int level, size_t frameIndex);
+
+    std::vector<double> _pixels;
+    double _budgetMs;
+
+    int _level;
+    size_t _changeFrame;
+
+    // Exponential moving averages of the samples since the last change
+    double _scaledMs;
+    double _fixedMs;
+    int _samples;
+};
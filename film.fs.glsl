@@ -6,11 +6,23 @@ in vec2 uvCoord;
 in vec4 posPos;
 
 out vec4 color;
-uniform float     iRandom;
-uniform vec3      iResolution;           // viewport resolution (in pixels)
-uniform float     iGlobalTime;           // shader playback time (in seconds)
 uniform sampler2D iChannel0;
-uniform sampler2D iChannel1;
+uniform sampler2D iChannel1;             // current frame
+uniform sampler2D iChannel2;             // previous frame (interleaved only)
+
+// Per-frame constants, shared by every stage; must match FrameConstants in
+// main.cpp.
+layout(std140) uniform FrameConstants {
+    vec3  iResolution;                   // render target resolution (in pixels)
+    float iGlobalTime;                   // shader playback time (in seconds)
+    vec2  iViewport;                     // output resolution (in pixels)
+    float iRandom;
+    int   iInterleave;                   // 0: off, else 1 + current field
+    vec4  iAudio;                        // kick, snare, hihat, wind
+    vec4  iTerrain;                      // heightfield origin xz, texel size, levels
+    vec4  iHistory;                      // previous frame's time, 1 if its hits are usable
+    vec4  iSunShadow;                    // world texels with a baked sun shadow, x0 z0 x1 z1
+};
 
 #define FxaaInt2 ivec2
 #define FxaaFloat2 vec2
@@ -63,12 +75,64 @@ vec3 Fxaa(
     return rgbB; 
 }
 
+// Returns true if the texel was shaded this frame, must match the
+// checkerboard in dunes.fs.glsl.
+bool isCurrentField(ivec2 p)
+{
+    ivec2 block = p / 2;
+    return ((block.x + block.y) & 1) == iInterleave - 1;
+}
+
+// The texel one block away, mirrored at the edges so it stays in the other
+// field; the texels outside the current field hold nothing valid.
+ivec2 neighborBlock(ivec2 p, ivec2 offset, ivec2 size)
+{
+    ivec2 q = p + offset;
+    if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size)))
+        q = p - offset;
+    return clamp(q, ivec2(0), size - 1);
+}
+
+vec4 fetchScene(ivec2 p, ivec2 size)
+{
+    p = clamp(p, ivec2(0), size - 1);
+    if (isCurrentField(p))
+        return texelFetch(iChannel1, p, 0);
+
+    // The texel is from the previous frame. Its horizontal and vertical
+    // neighbor blocks were all shaded this frame, so clamp it to their range
+    // to keep motion from leaving a comb pattern behind.
+    vec4 l = texelFetch(iChannel1, neighborBlock(p, ivec2(-2, 0), size), 0);
+    vec4 r = texelFetch(iChannel1, neighborBlock(p, ivec2( 2, 0), size), 0);
+    vec4 d = texelFetch(iChannel1, neighborBlock(p, ivec2( 0,-2), size), 0);
+    vec4 u = texelFetch(iChannel1, neighborBlock(p, ivec2( 0, 2), size), 0);
+    vec4 lo = min(min(l, r), min(d, u));
+    vec4 hi = max(max(l, r), max(d, u));
+    return clamp(texelFetch(iChannel2, p, 0), lo, hi);
+}
+
+// Bilinear sample of the scene, reconstructing interleaved frames per texel.
+vec4 sampleScene(vec2 uv)
+{
+    if (iInterleave == 0)
+        return texture(iChannel1, uv);
+
+    ivec2 size = textureSize(iChannel1, 0);
+    vec2 st = uv*vec2(size) - 0.5;
+    ivec2 i = ivec2(floor(st));
+    vec2 f = fract(st);
+    return mix(mix(fetchScene(i,              size),
+                   fetchScene(i + ivec2(1,0), size), f.x),
+               mix(fetchScene(i + ivec2(0,1), size),
+                   fetchScene(i + ivec2(1,1), size), f.x), f.y);
+}
+
 void main( void )
 {
     vec4 col = vec4(0,0,0,1);
 
     if (uvCoord.y < 1 && uvCoord.y > 0) {
-        col = texture(iChannel1, uvCoord);
+        col = sampleScene(uvCoord);
         //col.rgb = Fxaa(posPos, iChannel1, 1/iResolution.xy);
     }
 
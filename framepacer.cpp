@@ -0,0 +1,83 @@
+// Created by Jeremy Cowles, 2015
+
+#include "framepacer.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <thread>
+
+// Sleeping closer to the deadline than this risks waking up late
+static const std::chrono::microseconds _SpinMargin(2000);
+
+FramePacer::FramePacer(int framesInFlight, double fpsCap) :
+    _framesInFlight(std::min(std::max(framesInFlight, 1), MaxFramesInFlight)),
+    _slot(0),
+    _period(0),
+    _started(false)
+{
+    for (int i = 0; i < MaxFramesInFlight; i++)
+        _fences[i] = 0;
+    if (fpsCap > 0) {
+        _period = std::chrono::duration_cast<_Clock::duration>(
+            std::chrono::duration<double>(1.0 / fpsCap));
+    }
+}
+
+FramePacer::~FramePacer()
+{
+    for (int i = 0; i < MaxFramesInFlight; i++) {
+        if (_fences[i])
+            glDeleteSync(_fences[i]);
+    }
+}
+
+void
+FramePacer::BeginFrame()
+{
+    TraceScope scope("frame pacing");
+
+    // The oldest frame's fence, from framesInFlight frames ago
+    if (GLsync fence = _fences[_slot]) {
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+            flags = 0;
+        glDeleteSync(fence);
+        _fences[_slot] = 0;
+    }
+
+    _Pace();
+}
+
+void
+FramePacer::EndFrame()
+{
+    _fences[_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _slot = (_slot + 1) % _framesInFlight;
+}
+
+void
+FramePacer::_Pace()
+{
+    if (_period == _Clock::duration::zero())
+        return;
+
+    _Clock::time_point now = _Clock::now();
+    if (not _started) {
+        _deadline = now;
+        _started = true;
+    }
+
+    if (now < _deadline) {
+        _Clock::duration remaining = _deadline - now;
+        if (remaining > _SpinMargin)
+            std::this_thread::sleep_for(remaining - _SpinMargin);
+        while (_Clock::now() < _deadline)
+            std::this_thread::yield();
+    } else if (now - _deadline > _period) {
+        // More than a frame behind (a hitch, or a cap we can't hold): start
+        // over from here rather than rushing frames out to catch up.
+        _deadline = now;
+    }
+    _deadline += _period;
+}
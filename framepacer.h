@@ -0,0 +1,50 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <chrono>
+
+//
+// Bounds how far the CPU may run ahead of the GPU, and optionally how fast.
+//
+// Without a limit the driver queues as many frames as it likes, so input
+// and audio are sampled an unpredictable number of frames before the image
+// shows up. Each frame is fenced after the swap; before starting a new
+// frame the fence from framesInFlight frames ago is waited on, so at most
+// that many frames are ever queued. One frame in flight is the lowest
+// latency, three the highest throughput.
+//
+// The optional frame rate cap sleeps for most of the time left to the next
+// frame and spins (yielding) for the rest, because sleeps routinely
+// oversleep by a scheduler tick.
+//
+class FramePacer
+{
+public:
+    static const int MaxFramesInFlight = 3;
+
+    // fpsCap <= 0 disables the cap.
+    FramePacer(int framesInFlight, double fpsCap);
+    ~FramePacer();
+
+    // Call at the top of the frame, before sampling input or time.
+    void BeginFrame();
+
+    // Call after the swap.
+    void EndFrame();
+
+private:
+    typedef std::chrono::steady_clock _Clock;
+
+    void _Pace();
+
+    int _framesInFlight;
+    GLsync _fences[MaxFramesInFlight];
+    int _slot;
+
+    _Clock::duration _period;
+    _Clock::time_point _deadline;
+    bool _started;
+};
@@ -0,0 +1,204 @@
+// Created by Jeremy Cowles, 2015
+
+#include "framestats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+/* static */
+const double FrameHistogram::BinMs = 0.05;
+
+FrameHistogram::FrameHistogram(size_t window) :
+    _samples(std::max(window, size_t(1)), 0.0),
+    _bins(Bins, 0),
+    _next(0),
+    _count(0)
+{
+}
+
+/* static */
+int
+FrameHistogram::_Bin(double ms)
+{
+    int bin = int(ms / BinMs);
+    return std::min(std::max(bin, 0), Bins - 1);
+}
+
+void
+FrameHistogram::Add(double ms)
+{
+    // Once the window is full, the sample being overwritten leaves the
+    // histogram.
+    if (_count == _samples.size())
+        _bins[_Bin(_samples[_next])]--;
+    else
+        _count++;
+
+    _samples[_next] = ms;
+    _bins[_Bin(ms)]++;
+    _next = (_next + 1) % _samples.size();
+}
+
+void
+FrameHistogram::Clear()
+{
+    std::fill(_bins.begin(), _bins.end(), 0);
+    _next = 0;
+    _count = 0;
+}
+
+double
+FrameHistogram::Percentile(double p) const
+{
+    if (_count == 0)
+        return 0.0;
+
+    size_t rank = size_t(std::ceil(p * _count));
+    rank = std::min(std::max(rank, size_t(1)), _count);
+
+    size_t cumulative = 0;
+    for (int i = 0; i < Bins - 1; i++) {
+        cumulative += _bins[i];
+        if (cumulative >= rank)
+            return std::min((i + 1) * BinMs, Max());
+    }
+    return Max();
+}
+
+double
+FrameHistogram::Max() const
+{
+    double max = 0.0;
+    for (size_t i = 0; i < _count; i++)
+        max = std::max(max, _samples[i]);
+    return max;
+}
+
+double
+FrameHistogram::Mean() const
+{
+    if (_count == 0)
+        return 0.0;
+    double sum = 0.0;
+    for (size_t i = 0; i < _count; i++)
+        sum += _samples[i];
+    return sum / _count;
+}
+
+FrameStats::FrameStats(size_t window,
+                       std::vector<std::string> const & gpuScopes) :
+    _scopeNames(gpuScopes),
+    _cpu(window),
+    _gpu(window),
+    _gpuScopes(gpuScopes.size(), FrameHistogram(window))
+{
+}
+
+FrameStats::~FrameStats()
+{
+    Flush();
+}
+
+bool
+FrameStats::OpenCsv(std::string const & path)
+{
+    _csv.open(path.c_str());
+    if (not _csv.is_open()) {
+        std::cerr << "Failed to open " << path << " for writing\n";
+        return false;
+    }
+    _csv << "frame,cpu_ms,gpu_ms";
+    for (size_t i = 0; i < _scopeNames.size(); i++)
+        _csv << "," << _scopeNames[i] << "_ms";
+    _csv << "\n";
+    _csv << std::fixed << std::setprecision(4);
+    return true;
+}
+
+void
+FrameStats::AddCpuFrame(size_t index, double cpuMs)
+{
+    _cpu.Add(cpuMs);
+    if (not _csv.is_open())
+        return;
+
+    _Row row = { index, cpuMs };
+    _pending.push_back(row);
+
+    // GPU results are never more than the query ring deep behind; anything
+    // older than that was dropped (or the timer isn't running).
+    while (_pending.size() > size_t(2 * GpuTimer::Depth)) {
+        _WriteRow(_pending.front(), NULL);
+        _pending.pop_front();
+    }
+}
+
+void
+FrameStats::AddGpuFrame(GpuTimer::Frame const & gpu)
+{
+    _gpu.Add(gpu.frameMs);
+    for (size_t i = 0; i < _gpuScopes.size(); i++) {
+        if (gpu.ms[i] >= 0)
+            _gpuScopes[i].Add(gpu.ms[i]);
+    }
+
+    while (not _pending.empty() and _pending.front().index <= gpu.index) {
+        _Row const & row = _pending.front();
+        _WriteRow(row, row.index == gpu.index ? &gpu : NULL);
+        _pending.pop_front();
+    }
+}
+
+void
+FrameStats::Flush()
+{
+    while (not _pending.empty()) {
+        _WriteRow(_pending.front(), NULL);
+        _pending.pop_front();
+    }
+    if (_csv.is_open())
+        _csv.flush();
+}
+
+void
+FrameStats::_WriteRow(_Row const & row, GpuTimer::Frame const * gpu)
+{
+    // Missing GPU values are left empty rather than zero, so they don't
+    // skew anything downstream.
+    _csv << row.index << "," << row.cpuMs << ",";
+    if (gpu)
+        _csv << gpu->frameMs;
+    for (size_t i = 0; i < _scopeNames.size(); i++) {
+        _csv << ",";
+        if (gpu and gpu->ms[i] >= 0)
+            _csv << gpu->ms[i];
+    }
+    _csv << "\n";
+}
+
+static void
+_ReportSeries(std::ostream & out, std::string const & name,
+              FrameHistogram const & hist)
+{
+    if (hist.Count() == 0)
+        return;
+    out << std::setw(6) << std::left << name << std::right << std::fixed
+        << std::setprecision(2)
+        << "  p50 " << std::setw(6) << hist.Percentile(0.50)
+        << "  p95 " << std::setw(6) << hist.Percentile(0.95)
+        << "  p99 " << std::setw(6) << hist.Percentile(0.99)
+        << "  max " << std::setw(6) << hist.Max()
+        << " ms  (" << hist.Count() << " frames)\n";
+    out.unsetf(std::ios::floatfield);
+}
+
+void
+FrameStats::Report(std::ostream & out) const
+{
+    _ReportSeries(out, "CPU", _cpu);
+    _ReportSeries(out, "GPU", _gpu);
+    for (size_t i = 0; i < _gpuScopes.size(); i++)
+        _ReportSeries(out, _scopeNames[i], _gpuScopes[i]);
+}
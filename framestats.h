@@ -0,0 +1,88 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include "gputimer.h"
+
+#include <deque>
+#include <fstream>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+//
+// A rolling histogram over the last N frame times. Averages hide hitches, so
+// consumers should look at the upper percentiles and the max instead.
+//
+class FrameHistogram
+{
+    // 0.05ms bins up to 200ms, anything slower lands in the last bin
+    static const int Bins = 4000;
+    static const double BinMs;
+
+    std::vector<double> _samples;
+    std::vector<unsigned> _bins;
+    size_t _next;
+    size_t _count;
+
+    static int _Bin(double ms);
+
+public:
+    FrameHistogram(size_t window);
+
+    void Add(double ms);
+    void Clear();
+
+    // p in [0,1], resolution is one bin; returns 0 when empty
+    double Percentile(double p) const;
+    double Max() const;
+    double Mean() const;
+    size_t Count() const { return _count; }
+};
+
+//
+// Per-frame CPU and GPU timing statistics, with an optional CSV log of every
+// frame. GPU results arrive a few frames late, so CSV rows are held back
+// until the matching GPU frame resolves (or is known to have been dropped).
+//
+class FrameStats
+{
+public:
+    // gpuScopes names the GpuTimer scopes, in scope order
+    FrameStats(size_t window, std::vector<std::string> const & gpuScopes);
+    ~FrameStats();
+
+    bool OpenCsv(std::string const & path);
+
+    void AddCpuFrame(size_t index, double cpuMs);
+    void AddGpuFrame(GpuTimer::Frame const & gpu);
+
+    // Writes one line per series: p50/p95/p99/max over the rolling window.
+    void Report(std::ostream & out) const;
+
+    // Writes any CSV rows still waiting on GPU results.
+    void Flush();
+
+    FrameHistogram const & GetCpu() const { return _cpu; }
+    FrameHistogram const & GetGpu() const { return _gpu; }
+    FrameHistogram const & GetGpuScope(int scope) const
+    {
+        return _gpuScopes[scope];
+    }
+
+private:
+    struct _Row {
+        size_t index;
+        double cpuMs;
+    };
+
+    void _WriteRow(_Row const & row, GpuTimer::Frame const * gpu);
+
+    std::vector<std::string> _scopeNames;
+    FrameHistogram _cpu;
+    FrameHistogram _gpu;
+    std::vector<FrameHistogram> _gpuScopes;
+
+    std::ofstream _csv;
+    std::deque<_Row> _pending;
+};
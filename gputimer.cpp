@@ -0,0 +1,140 @@
+// Created by Jeremy Cowles, 2015
+
+#include "gputimer.h"
+
+#include <cstring>
+
+GpuTimer::GpuTimer() :
+    _slot(0),
+    _frameCount(0),
+    _initialized(false)
+{
+    memset(_queries, 0, sizeof(_queries));
+    memset(_used, 0, sizeof(_used));
+    memset(_pending, 0, sizeof(_pending));
+    memset(_index, 0, sizeof(_index));
+}
+
+void
+GpuTimer::Init()
+{
+    glGenQueries(Depth*MaxScopes*2, &_queries[0][0][0]);
+    _initialized = true;
+}
+
+void
+GpuTimer::BeginFrame()
+{
+    if (not _initialized)
+        return;
+
+    //
+    // If the slot we're about to reuse still hasn't resolved, the GPU is more
+    // than Depth frames behind. Give up on that frame instead of blocking;
+    // re-issuing a query discards its previous result.
+    //
+    if (_pending[_slot])
+        _Resolve(_slot);
+    _pending[_slot] = false;
+    _index[_slot] = _frameCount++;
+    memset(_used[_slot], 0, sizeof(_used[_slot]));
+}
+
+void
+GpuTimer::Begin(int scope)
+{
+    if (not _initialized)
+        return;
+    glQueryCounter(_queries[_slot][scope][0], GL_TIMESTAMP);
+}
+
+void
+GpuTimer::End(int scope)
+{
+    if (not _initialized)
+        return;
+    glQueryCounter(_queries[_slot][scope][1], GL_TIMESTAMP);
+    _used[_slot][scope] = true;
+}
+
+void
+GpuTimer::EndFrame()
+{
+    if (not _initialized)
+        return;
+
+    _pending[_slot] = true;
+    _slot = (_slot + 1) % Depth;
+
+    // Walk from the oldest frame in flight to the newest, stopping at the
+    // first one that isn't ready; later frames can't be ready either.
+    for (int i = 0; i < Depth; i++) {
+        int slot = (_slot + i) % Depth;
+        if (not _pending[slot])
+            continue;
+        if (not _Resolve(slot))
+            break;
+    }
+}
+
+void
+GpuTimer::Flush()
+{
+    if (not _initialized)
+        return;
+    for (int i = 0; i < Depth; i++) {
+        int slot = (_slot + i) % Depth;
+        if (_pending[slot])
+            _Resolve(slot);
+    }
+}
+
+bool
+GpuTimer::PopFrame(Frame* frame)
+{
+    if (_resolved.empty())
+        return false;
+    *frame = _resolved.front();
+    _resolved.pop_front();
+    return true;
+}
+
+bool
+GpuTimer::_Resolve(int slot)
+{
+    for (int s = 0; s < MaxScopes; s++) {
+        if (not _used[slot][s])
+            continue;
+        GLuint available = 0;
+        glGetQueryObjectuiv(_queries[slot][s][1], GL_QUERY_RESULT_AVAILABLE,
+                            &available);
+        if (not available)
+            return false;
+    }
+
+    Frame frame;
+    frame.index = _index[slot];
+    GLuint64 first = 0, last = 0;
+    for (int s = 0; s < MaxScopes; s++) {
+        if (not _used[slot][s]) {
+            frame.ms[s] = -1;
+            continue;
+        }
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(_queries[slot][s][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(_queries[slot][s][1], GL_QUERY_RESULT, &end);
+        frame.ms[s] = (end - begin) / 1e6;
+        if (first == 0 or begin < first)
+            first = begin;
+        if (end > last)
+            last = end;
+    }
+    frame.frameMs = first ? (last - first) / 1e6 : -1;
+
+    // Nobody is consuming the results, don't grow without bound.
+    if (_resolved.size() >= 64)
+        _resolved.pop_front();
+    _resolved.push_back(frame);
+    _pending[slot] = false;
+    return true;
+}
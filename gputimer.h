@@ -0,0 +1,73 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <deque>
+#include <cstddef>
+
+//
+// GPU pass timing using GL_TIMESTAMP queries.
+//
+// Each frame records a begin/end timestamp pair per scope. Query objects live
+// in a ring several frames deep and results are only read back once the
+// driver reports them available, so timing never stalls the pipeline; the
+// reported numbers simply lag the current frame by a few frames.
+//
+class GpuTimer
+{
+public:
+    // Frames of queries kept in flight, must exceed the driver's queue depth
+    // or results will be dropped rather than waited on.
+    static const int Depth = 4;
+    static const int MaxScopes = 8;
+
+    // Timings for one resolved frame.
+    struct Frame {
+        // Index of the frame, counted in BeginFrame calls
+        size_t index;
+
+        // GPU milliseconds from the first Begin to the last End of the frame
+        double frameMs;
+
+        // GPU milliseconds per scope, -1 if the scope was not recorded
+        double ms[MaxScopes];
+    };
+
+    GpuTimer();
+
+    // Creates the query objects, requires a current GL context.
+    void Init();
+
+    void BeginFrame();
+    void Begin(int scope);
+    void End(int scope);
+
+    //
+    // Closes the current frame and reads back any earlier frames whose
+    // results have become available, queueing them for PopFrame.
+    //
+    void EndFrame();
+
+    // Resolves every frame still in flight; only call once the GPU is idle
+    // (e.g. after glFinish) or it will block.
+    void Flush();
+
+    // Returns the oldest resolved frame not yet popped, in frame order.
+    // Frames that were dropped are never returned.
+    bool PopFrame(Frame* frame);
+
+private:
+    bool _Resolve(int slot);
+
+    GLuint _queries[Depth][MaxScopes][2];
+    bool _used[Depth][MaxScopes];
+    bool _pending[Depth];
+    size_t _index[Depth];
+    int _slot;
+    size_t _frameCount;
+    bool _initialized;
+
+    std::deque<Frame> _resolved;
+};
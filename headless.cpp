@@ -0,0 +1,190 @@
+// Created by Jeremy Cowles, 2015
+
+#include "headless.h"
+
+#include <iostream>
+
+#if __APPLE__
+
+bool CreateHeadlessContext(int width, int height)
+{
+    std::cerr << "Headless rendering requires EGL, which is not available "
+                 "on this platform\n";
+    return false;
+}
+
+void DestroyHeadlessContext()
+{
+}
+
+bool CreateHeadlessSharedContext()
+{
+    return false;
+}
+
+void MakeHeadlessSharedContextCurrent()
+{
+}
+
+void ReleaseHeadlessSharedContext()
+{
+}
+
+#else
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static EGLDisplay _display = EGL_NO_DISPLAY;
+static EGLSurface _surface = EGL_NO_SURFACE;
+static EGLContext _context = EGL_NO_CONTEXT;
+static EGLConfig _config;
+static EGLSurface _sharedSurface = EGL_NO_SURFACE;
+static EGLContext _sharedContext = EGL_NO_CONTEXT;
+
+// Must match _GLSetCoreProfile
+static const EGLint _contextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 4,
+    EGL_CONTEXT_MINOR_VERSION, 1,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
+    EGL_NONE
+};
+
+static EGLDisplay
+_GetDisplay()
+{
+    //
+    // Prefer the surfaceless platform, it needs neither a window system nor a
+    // GPU device node. Older EGL implementations don't expose it, in which
+    // case we fall back to whatever the default display happens to be.
+    //
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+            eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                                EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY)
+            return display;
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool CreateHeadlessContext(int width, int height)
+{
+    _display = _GetDisplay();
+    EGLint major, minor;
+    if (_display == EGL_NO_DISPLAY
+        or not eglInitialize(_display, &major, &minor))
+    {
+        std::cerr << "Failed to initialize EGL display\n";
+        return false;
+    }
+    std::cout << "EGL " << major << "." << minor << std::endl;
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLint numConfigs = 0;
+    if (not eglChooseConfig(_display, configAttribs, &_config, 1, &numConfigs)
+        or numConfigs == 0)
+    {
+        std::cerr << "No EGL config supports pbuffer rendering\n";
+        return false;
+    }
+
+    const EGLint pbufferAttribs[] = {
+        EGL_WIDTH, width,
+        EGL_HEIGHT, height,
+        EGL_NONE
+    };
+    _surface = eglCreatePbufferSurface(_display, _config, pbufferAttribs);
+    if (_surface == EGL_NO_SURFACE) {
+        std::cerr << "Failed to create EGL pbuffer: "
+                  << std::hex << eglGetError() << std::dec << "\n";
+        return false;
+    }
+
+    eglBindAPI(EGL_OPENGL_API);
+    _context = eglCreateContext(_display, _config, EGL_NO_CONTEXT,
+                                _contextAttribs);
+    if (_context == EGL_NO_CONTEXT) {
+        std::cerr << "Failed to create EGL context: "
+                  << std::hex << eglGetError() << std::dec << "\n";
+        return false;
+    }
+
+    if (not eglMakeCurrent(_display, _surface, _surface, _context)) {
+        std::cerr << "Failed to make EGL context current\n";
+        return false;
+    }
+    return true;
+}
+
+void DestroyHeadlessContext()
+{
+    if (_display == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (_sharedContext != EGL_NO_CONTEXT)
+        eglDestroyContext(_display, _sharedContext);
+    if (_sharedSurface != EGL_NO_SURFACE)
+        eglDestroySurface(_display, _sharedSurface);
+    if (_context != EGL_NO_CONTEXT)
+        eglDestroyContext(_display, _context);
+    if (_surface != EGL_NO_SURFACE)
+        eglDestroySurface(_display, _surface);
+    eglTerminate(_display);
+    _display = EGL_NO_DISPLAY;
+    _surface = EGL_NO_SURFACE;
+    _context = EGL_NO_CONTEXT;
+    _sharedSurface = EGL_NO_SURFACE;
+    _sharedContext = EGL_NO_CONTEXT;
+}
+
+bool CreateHeadlessSharedContext()
+{
+    // The worker never presents, a minimal pbuffer keeps us from depending
+    // on EGL_KHR_surfaceless_context.
+    const EGLint pbufferAttribs[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+    };
+    _sharedSurface = eglCreatePbufferSurface(_display, _config,
+                                             pbufferAttribs);
+    _sharedContext = eglCreateContext(_display, _config, _context,
+                                      _contextAttribs);
+    if (_sharedSurface == EGL_NO_SURFACE
+        or _sharedContext == EGL_NO_CONTEXT)
+    {
+        std::cerr << "Failed to create shared EGL context: "
+                  << std::hex << eglGetError() << std::dec << "\n";
+        return false;
+    }
+    return true;
+}
+
+void MakeHeadlessSharedContextCurrent()
+{
+    eglBindAPI(EGL_OPENGL_API);
+    eglMakeCurrent(_display, _sharedSurface, _sharedSurface, _sharedContext);
+}
+
+void ReleaseHeadlessSharedContext()
+{
+    eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+#endif
@@ -0,0 +1,23 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+//
+// Offscreen GL context management for machines without a display.
+//
+// The context is created through EGL with a pbuffer surface, preferring the
+// Mesa surfaceless platform so that no X server or DRM device is needed (e.g.
+// llvmpipe on a render box). The pbuffer acts as the default framebuffer, so
+// the regular frame loop can render into it unmodified.
+//
+bool CreateHeadlessContext(int width, int height);
+void DestroyHeadlessContext();
+
+//
+// A second context sharing objects with the headless context, for a worker
+// thread. Create it on the render thread, then bind and release it on the
+// worker.
+//
+bool CreateHeadlessSharedContext();
+void MakeHeadlessSharedContextCurrent();
+void ReleaseHeadlessSharedContext();
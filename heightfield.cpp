@@ -0,0 +1,66 @@
+// Created by Jeremy Cowles, 2015
+
+#include "heightfield.h"
+
+#include <cmath>
+
+// The tile moves in steps of this many texels, a fraction of its size so
+// the camera never gets close to an edge.
+static const int _SnapTexels = 128;
+
+Heightfield::Heightfield() :
+    _texture(0),
+    _size(0),
+    _levels(0),
+    _texelSize(0),
+    _valid(false)
+{
+    _origin[0] = _origin[1] = 0;
+}
+
+void
+Heightfield::Init(int size, float texelSize)
+{
+    _size = size;
+    _texelSize = texelSize;
+    _levels = 1;
+    while ((size >> _levels) > 0)
+        _levels++;
+    _valid = false;
+
+    // Only ever read with texelFetch, the filters just keep it complete.
+    glGenTextures(1, &_texture);
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, _levels - 1);
+    if (GLEW_ARB_texture_storage) {
+        glTexStorage2D(GL_TEXTURE_2D, _levels, GL_R32F, size, size);
+    } else {
+        for (int i = 0; i < _levels; i++) {
+            glTexImage2D(GL_TEXTURE_2D, i, GL_R32F, size >> i, size >> i, 0,
+                         GL_RED, GL_FLOAT, NULL);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool
+Heightfield::Update(float x, float z)
+{
+    float snap = _SnapTexels * _texelSize;
+    float half = 0.5f * _size * _texelSize;
+    float origin[2] = { std::floor((x - half) / snap + 0.5f) * snap,
+                        std::floor((z - half) / snap + 0.5f) * snap };
+
+    bool moved = origin[0] != _origin[0] or origin[1] != _origin[1];
+    if (_valid and not moved)
+        return false;
+    _origin[0] = origin[0];
+    _origin[1] = origin[1];
+    _valid = true;
+    return true;
+}
@@ -0,0 +1,56 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+//
+// A square tile of the terrain's height, baked on the GPU around the camera,
+// with a max mip pyramid over it: every texel of level N holds the highest of
+// the four texels below it, so one fetch bounds the terrain under a whole
+// 2^N texel cell. The dunes shader walks the pyramid to step over empty
+// space in large strides, and only marches the analytic terrain close to it.
+//
+// The tile follows the camera in snapped steps, so it only needs re-baking
+// about once a second of flight; between moves it is just read.
+//
+class Heightfield
+{
+public:
+    Heightfield();
+
+    //
+    // Allocates the R32F pyramid, size texels across at level 0 (a power of
+    // two), each texelSize world units across. Requires a current GL
+    // context.
+    //
+    void Init(int size, float texelSize);
+
+    //
+    // Moves the tile so it covers the given world xz, which ends up near its
+    // center, and returns true if it must be baked (again) before it is read:
+    // when it moved, or was invalidated.
+    //
+    bool Update(float x, float z);
+
+    // Forces a re-bake on the next Update, e.g. after the terrain's shader
+    // was reloaded.
+    void Invalidate() { _valid = false; }
+
+    GLuint GetTexture() const { return _texture; }
+    int GetSize() const { return _size; }
+    int GetLevels() const { return _levels; }
+    float GetTexelSize() const { return _texelSize; }
+
+    // World xz of the tile's corner, the lower left of texel (0, 0).
+    float GetOriginX() const { return _origin[0]; }
+    float GetOriginZ() const { return _origin[1]; }
+
+private:
+    GLuint _texture;
+    int _size;
+    int _levels;
+    float _texelSize;
+    float _origin[2];
+    bool _valid;
+};
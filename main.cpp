@@ -1,6 +1,23 @@
 // Created by Jeremy Cowles, 2015
 
+#include "archive.h"
 #include "audio.h"
+#include "capture.h"
+#include "dynres.h"
+#include "framepacer.h"
+#include "framestats.h"
+#include "gputimer.h"
+#include "headless.h"
+#include "heightfield.h"
+#include "rendergraph.h"
+#include "shadercache.h"
+#include "shaderreload.h"
+#include "spscqueue.h"
+#include "sunshadow.h"
+#include "texturestream.h"
+#include "timeline.h"
+#include "trace.h"
+#include "uniformring.h"
 
 #include "lodepng/lodepng.h"
 
@@ -8,11 +25,19 @@
 #include <GLFW/glfw3.h>
 
 
-#include <cstdlib>  // for rand
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
 
 /* -------------------------------------------------------------------------- */
 /* GLFW CALLBACKS                                                             */
@@ -24,11 +49,72 @@ _ErrorCallback(int error, const char* description)
     std::cerr << "GLFW Error[" << error << "]: " << description << "\n";
 }
 
+// The demo clock, sampled once per frame by the render loops and only
+// ever touched by the thread rendering.
+Timeline _timeline;
+Timeline::Mode _playMode = Timeline::RealTime;
+
+//
+// In windowed mode events are handled on the main thread and everything
+// else happens on the render thread, so input reaches the timeline through
+// a queue, applied at the top of the next frame.
+//
+struct InputEvent {
+    enum Type { ToggleScrub, Nudge, Quit };
+    Type type;
+    double seconds;             // Nudge only
+};
+SpscQueue<InputEvent, 64> _input;
+
+static void
+_PushInput(InputEvent::Type type, double seconds = 0)
+{
+    InputEvent event = { type, seconds };
+    if (not _input.Push(event))
+        std::cerr << "Input queue full, dropped an event\n";
+}
+
 static void 
 _KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) 
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GL_TRUE);
+
+    // Space pauses into scrub mode, the arrows step through time
+    if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+        _PushInput(InputEvent::ToggleScrub);
+    if (action != GLFW_RELEASE) {
+        double step = (mods & GLFW_MOD_SHIFT) ? 0.1 : 1.0;
+        if (key == GLFW_KEY_LEFT)
+            _PushInput(InputEvent::Nudge, -step);
+        else if (key == GLFW_KEY_RIGHT)
+            _PushInput(InputEvent::Nudge, step);
+    }
+}
+
+// Render thread only, returns false once asked to quit.
+static bool
+_ApplyInput()
+{
+    InputEvent event;
+    while (_input.Pop(&event)) {
+        switch (event.type) {
+        case InputEvent::ToggleScrub:
+            if (_timeline.GetMode() == Timeline::Scrub) {
+                _timeline.SetMode(_playMode);
+            } else {
+                _playMode = _timeline.GetMode();
+                _timeline.SetMode(Timeline::Scrub);
+            }
+            break;
+        case InputEvent::Nudge:
+            _timeline.Nudge(event.seconds);
+            break;
+        case InputEvent::Quit:
+            return false;
+        }
+    }
+    return true;
 }
 
 
@@ -39,32 +125,73 @@ _KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 GLuint _vao = 0;
 GLuint _quadBuffer = 0;
 
+// Per-frame constants are shared by both programs through one uniform
+// block, see FrameConstants in the shaders. Passes drawing with the same
+// program tell it which one it is running through iPass, if it has one.
 struct QuadProgram {
     GLuint program;
-    GLint iRandomLoc;
-    GLint iResolutionLoc;
-    GLint iGlobalTimeLoc;
-    GLint iMouseLoc;
-    GLint iChannel0Loc;
-    GLint iChannel1Loc;
+    GLint passLoc;
 };
 QuadProgram _shaderToy;
 QuadProgram _film;
-GLuint _texBuffers[2];
+
+// Values of iPass in dunes.fs.glsl
+enum { _ShadePass, _BakeHeightsPass, _ReduceHeightsPass, _ConeDepthPass,
+       _BakeShadowPass };
+
+//
+// Mirrors the std140 FrameConstants block declared in the shaders, member
+// for member; keep the two in sync. The padding falls out naturally: the vec3
+// is followed by a float and the vec4 starts on a 16 byte boundary.
+//
+struct FrameConstants {
+    float iResolution[3];       // render target resolution (in pixels)
+    float iGlobalTime;          // shader playback time (in seconds)
+    float iViewport[2];         // output resolution (in pixels)
+    float iRandom;
+    int   iInterleave;          // 0: off, else 1 + current field
+    float iAudio[4];            // kick, snare, hihat, wind
+    float iTerrain[4];          // heightfield origin xz, texel size, levels
+    float iHistory[4];          // previous frame's time, 1 if its hits are usable
+    float iSunShadow[4];        // world texels with a baked sun shadow, x0 z0 x1 z1
+};
+static_assert(sizeof(FrameConstants) == 96, "FrameConstants must match std140");
+
+static const GLuint _FrameConstantsBinding = 0;
+UniformRing _frameConstants;
+
+// GPU timer scopes, one per pass (the heightfield bake counts as one)
+enum { _GpuDunes, _GpuFilm, _GpuTerrain, _GpuSunShadow };
+GpuTimer _gpuTimer;
+
+static std::vector<std::string>
+_GpuScopeNames()
+{
+    std::vector<std::string> names;
+    names.push_back("dunes");
+    names.push_back("film");
+    names.push_back("terrain");
+    names.push_back("sun shadow");
+    return names;
+}
+
+//
+// Set when GL reports an error, or GLEW or a shader fails, instead of
+// exiting on the spot: the thread owning the context checks it and shuts
+// down in order, which for the render thread means handing back to main().
+//
+bool _glFailed = false;
 
 static void
 _GLCheckError(std::string const & where = "")
 {
     GLuint err;
-    int count = 0;
     while ((err = glGetError()) != GL_NO_ERROR) {
         std::cerr << "GL error: "
                   << (where.empty() ? "" : where + " ")
                   << err << std::endl;
-        count++;
+        _glFailed = true;
     }
-    if (count)
-        exit(EXIT_FAILURE);
 }
 
 static void
@@ -80,58 +207,148 @@ static void
 _GLEWInit()
 {
     glewExperimental = true;
-    if (GLenum r = glewInit() != GLEW_OK) {
-        std::cerr << "Failed to initialize glew. Error = %s\n", glewGetErrorString(r);
-        exit(EXIT_FAILURE);
+    GLenum r = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // GLEW built against GLX reports this for EGL contexts, but only after
+    // the core entry points have already been loaded.
+    if (r == GLEW_ERROR_NO_GLX_DISPLAY)
+        r = GLEW_OK;
+#endif
+    if (r != GLEW_OK) {
+        std::cerr << "Failed to initialize glew. Error = " << glewGetErrorString(r) << "\n";
+        _glFailed = true;
+        return;
     }
     // Glew causes GL errors :(
     glGetError();
 }
 
+//
+// Shader compilation is split into issuing the work and collecting the
+// results. Nothing may query compile or link state in between, since any
+// such query forces the driver to finish the work synchronously; with
+// KHR_parallel_shader_compile the driver compiles on its own threads while
+// we get on with the rest of start-up.
+//
+struct PendingProgram {
+    GLuint program;
+    GLuint vertexShader;
+    GLuint fragmentShader;
+    std::string cacheKey;
+    std::string name;
+};
+
+static void
+_GLInitParallelCompile()
+{
+    if (GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    else if (GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+}
+
 static GLuint
 _GLCompileShader(GLenum shaderType, const char *source)
 {
     GLuint shader = glCreateShader(shaderType);
     glShaderSource(shader, 1, &source, NULL);
     glCompileShader(shader);
-    char log[1024];
-    GLsizei length;
-    glGetShaderInfoLog(shader, 1024, &length, log);
-    if (length > 0) {
-        std::cerr << "Failed to compile: " << source << "\n\n" << log << std::endl;
-        exit(EXIT_FAILURE);
-    }
     _GLCheckError("_GLCompileShader");
     return shader;
 }
 
-static GLuint 
-_GLLinkProgram(char const* vsSrc, char const* fsSrc) {
+static bool
+_GLCheckShader(GLuint shader, std::string const & name)
+{
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status == GL_FALSE) {
+        char log[1024];
+        GLsizei length = 0;
+        glGetShaderInfoLog(shader, 1024, &length, log);
+        std::cerr << "Failed to compile: " << name << "\n\n" << log << std::endl;
+        return false;
+    }
+    return true;
+}
 
+static void
+_GLBeginLinkProgram(char const* vsSrc, char const* fsSrc,
+                    std::string const & name, PendingProgram* pp)
+{
+    TraceScope scope("begin link program");
+    pp->name = name;
+    pp->vertexShader = pp->fragmentShader = 0;
+
+    // Linking the dunes shader can take seconds on some drivers, try the
+    // binary from a previous run first.
+    pp->cacheKey = ShaderCacheKey(vsSrc, fsSrc);
+    pp->program = LoadCachedProgram(pp->cacheKey);
+    if (pp->program) {
+        pp->cacheKey.clear();
+        return;
+    }
 
-    GLuint program = glCreateProgram();
-    GLuint vertexShader = _GLCompileShader(GL_VERTEX_SHADER, vsSrc);
-    GLuint fragmentShader = _GLCompileShader(GL_FRAGMENT_SHADER, fsSrc);
+    pp->program = glCreateProgram();
+    pp->vertexShader = _GLCompileShader(GL_VERTEX_SHADER, vsSrc);
+    pp->fragmentShader = _GLCompileShader(GL_FRAGMENT_SHADER, fsSrc);
 
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
+    glAttachShader(pp->program, pp->vertexShader);
+    glAttachShader(pp->program, pp->fragmentShader);
 
     //glBindAttribLocation (program, 0, "position");
-    glLinkProgram(program);
+    glProgramParameteri(pp->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(pp->program);
+}
 
+// Non-blocking check for link completion, always true without the extension.
+static bool
+_GLIsProgramReady(PendingProgram const & pp)
+{
+    if (not GLEW_KHR_parallel_shader_compile
+        and not GLEW_ARB_parallel_shader_compile)
+        return true;
+    GLint done = GL_TRUE;
+    glGetProgramiv(pp.program, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+// Returns 0 and sets _glFailed if the program didn't compile or link.
+static GLuint
+_GLFinishLinkProgram(PendingProgram* pp)
+{
+    TraceScope scope("finish link program");
     GLint status;
-    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    glGetProgramiv(pp->program, GL_LINK_STATUS, &status);
     if (status == GL_FALSE) {
-        GLint infoLogLength;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLength);
-        char *infoLog = new char[infoLogLength];
-        glGetProgramInfoLog(program, infoLogLength, NULL, infoLog);
-        std::cerr << "Shader link failed: " << infoLog << "\n";
-        delete[] infoLog;
-        exit(EXIT_FAILURE);
+        // Compile errors are more useful than the link error they cause.
+        bool compiled = (not pp->vertexShader or _GLCheckShader(
+                             pp->vertexShader, pp->name + " (vertex)"))
+            and (not pp->fragmentShader or _GLCheckShader(
+                     pp->fragmentShader, pp->name + " (fragment)"));
+        if (compiled) {
+            GLint infoLogLength;
+            glGetProgramiv(pp->program, GL_INFO_LOG_LENGTH, &infoLogLength);
+            char *infoLog = new char[infoLogLength];
+            glGetProgramInfoLog(pp->program, infoLogLength, NULL, infoLog);
+            std::cerr << "Shader link failed: " << pp->name << ": " << infoLog << "\n";
+            delete[] infoLog;
+        }
+        glDeleteProgram(pp->program);
+        glDeleteShader(pp->vertexShader);
+        glDeleteShader(pp->fragmentShader);
+        _glFailed = true;
+        return 0;
     }
 
-    return program;
+    if (pp->vertexShader) {
+        glDetachShader(pp->program, pp->vertexShader);
+        glDetachShader(pp->program, pp->fragmentShader);
+        glDeleteShader(pp->vertexShader);
+        glDeleteShader(pp->fragmentShader);
+        StoreCachedProgram(pp->cacheKey, pp->program);
+    }
+    return pp->program;
 }
 
 static std::string 
@@ -149,174 +366,1336 @@ _ReadFile(std::string path)
     return ss.str();
 }
 
+// Packed assets, when an archive was found; loose files otherwise.
+AssetArchive _assets;
+
+//
+// Archived shaders are skipped under --watch, since the reloader only
+// follows the loose files, and whenever a loose file was edited after the
+// archive was packed, so a stale archive never hides the current text.
+//
+bool _looseShaders = false;
+long long _assetsTime = 0;
+
+static long long
+_ModificationTime(std::string const & path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return 0;
+    return (long long)st.st_mtime;
+}
+
+static bool
+_UseArchivedShader(std::string const & path)
+{
+    return not _looseShaders and _ModificationTime(path) <= _assetsTime;
+}
+
 static void 
-_LinkQuadProgram(std::string vs, std::string fs, QuadProgram* qp)
+_BeginLinkQuadProgram(std::string vs, std::string fs, PendingProgram* pp)
 {
+    std::string name = vs + " + " + fs;
+
+    // Archived text is NUL terminated in place, no copies needed
+    AssetArchive::Span vsSpan, fsSpan;
+    if (_UseArchivedShader(vs) and _UseArchivedShader(fs)
+        and _assets.Find(vs, &vsSpan) and _assets.Find(fs, &fsSpan)) {
+        _GLBeginLinkProgram((char const*)vsSpan.data,
+                            (char const*)fsSpan.data, name, pp);
+        return;
+    }
+
     vs = _ReadFile(vs); 
     fs = _ReadFile(fs); 
+    _GLBeginLinkProgram(vs.c_str(), fs.c_str(), name, pp);
+}
 
-    qp->program = _GLLinkProgram(vs.c_str(), fs.c_str());
-    qp->iRandomLoc = glGetUniformLocation(qp->program, "iRandom");
-    qp->iResolutionLoc = glGetUniformLocation(qp->program, "iResolution");
-    qp->iGlobalTimeLoc = glGetUniformLocation(qp->program, "iGlobalTime");
-    qp->iChannel0Loc = glGetUniformLocation(qp->program, "iChannel0");
-    qp->iChannel1Loc = glGetUniformLocation(qp->program, "iChannel1");
-    //qp->iMouseLoc = glGetUniformLocation(qp->program, "iMouse");
+static void 
+_SetQuadProgram(GLuint program, QuadProgram* qp)
+{
+    qp->program = program;
+
+    GLuint block = glGetUniformBlockIndex(program, "FrameConstants");
+    if (block != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, block, _FrameConstantsBinding);
+
+    // Samplers never change, channel N always reads texture unit N.
+    char const* channels[] = { "iChannel0", "iChannel1", "iChannel2",
+                               "iChannel3", "iChannel4" };
+    for (int i = 0; i < 5; i++) {
+        GLint loc = glGetUniformLocation(program, channels[i]);
+        if (loc >= 0)
+            glProgramUniform1i(program, loc, i);
+    }
+    qp->passLoc = glGetUniformLocation(program, "iPass");
+}
+
+// Selects what the program's next draws do, see iPass.
+static void
+_SetQuadPass(QuadProgram const & qp, int pass)
+{
+    if (qp.passLoc >= 0)
+        glProgramUniform1i(qp.program, qp.passLoc, pass);
+}
+
+static void 
+_FinishLinkQuadProgram(PendingProgram* pp, QuadProgram* qp)
+{
+    GLuint program = _GLFinishLinkProgram(pp);
+    if (program)
+        _SetQuadProgram(program, qp);
+}
+
+// Programs being compiled during start-up, see _GLInit and _InitScene
+PendingProgram _pendingShaderToy;
+PendingProgram _pendingFilm;
+
+// Hot reload, only running with --watch
+ShaderReloader _reloader;
+int _shaderToySlot = _reloader.Watch("quad.vs.glsl", "dunes.fs.glsl");
+int _filmSlot = _reloader.Watch("aspect.vs.glsl", "film.fs.glsl");
+
+// Baked from the dunes program, see _RenderFrame
+Heightfield _heightfield;
+SunShadow _sunShadow;
+
+// Swaps in programs relinked by the reloader; called between frames so a
+// frame never sees half of an update.
+static void
+_UpdateReloadedPrograms()
+{
+    GLuint program;
+    if (_reloader.TakeProgram(_shaderToySlot, &program)) {
+        glDeleteProgram(_shaderToy.program);
+        _SetQuadProgram(program, &_shaderToy);
+        // The terrain may have changed
+        _heightfield.Invalidate();
+        _sunShadow.Invalidate();
+    }
+    if (_reloader.TakeProgram(_filmSlot, &program)) {
+        glDeleteProgram(_film.program);
+        _SetQuadProgram(program, &_film);
+    }
+}
+
+//
+// Pipeline state for full-screen passes: every pass draws one quad that
+// covers its whole target, so there is nothing to depth test, blend or cull,
+// and no target needs a depth buffer. This is the only state the frame uses;
+// the sun shadow bake scissors its quads, and turns the test off again.
+//
+static void
+_SetFullscreenPassState()
+{
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_SCISSOR_TEST);
 }
 
 static void
 _GLInit()
 {
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glEnable(GL_DEPTH_TEST);
-    glFrontFace(GL_CCW);
-    glEnable(GL_CULL_FACE);
-    glDepthFunc(GL_LEQUAL);
-    glCullFace(GL_BACK);
+    _SetFullscreenPassState();
     _GLCheckError("Setup state");
 
     glGenVertexArrays(1, &_vao);
     glBindVertexArray(_vao);
 
     // Setup a full-screen quad in clip coordinates as two CCW 2-dimensional
-    // triangles
+    // triangles; it stays attached to the VAO, so every pass just draws.
     glGenBuffers(1, &_quadBuffer);
     _GLCheckError("GenQuadBuffer");
     float quadData[] = { -1,-1,   1,-1,  -1, 1,
                           1, 1,  -1, 1,   1,-1  };
     glBindBuffer(GL_ARRAY_BUFFER, _quadBuffer);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quadData), quadData, GL_STATIC_READ);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(/*attrib*/0, /*vec2*/2, GL_FLOAT, /*normalized*/GL_FALSE, 
+                            /*stride*/0, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     _GLCheckError("BufferData");
 
-    _LinkQuadProgram("quad.vs.glsl", "dunes.fs.glsl", &_shaderToy);
-    _LinkQuadProgram("aspect.vs.glsl", "film.fs.glsl", &_film);
+    // Only issues the compiles, see _InitScene
+    _GLInitParallelCompile();
+    _BeginLinkQuadProgram("quad.vs.glsl", "dunes.fs.glsl", &_pendingShaderToy);
+    _BeginLinkQuadProgram("aspect.vs.glsl", "film.fs.glsl", &_pendingFilm);
 }
 
-GLuint _fbo;
-GLuint _rboDepth;
-GLuint _rboColor;
+//
+// Offscreen target for the dunes pass, with frame textures sized to the
+// render resolution. There is one per render scale level, all allocated up
+// front so changing resolution never allocates inside the frame loop.
+//
+// Frames alternate between the two frame textures (and their FBOs, which
+// share the depth buffer), so the previous frame is always available to the
+// film pass for interleaved rendering.
+//
+// The dunes pass also writes each pixel's hit distance, alternating the same
+// way, for the next frame to start its rays from.
+//
+// The frame textures persist across frames (interleaving reads the previous
+// one), so they are owned here and imported into the graph; framebuffers and
+// everything transient belong to the graph.
+struct RenderTarget {
+    GLuint texBuffers[2];
+    GLuint hitBuffers[2];
+    GLsizei width;
+    GLsizei height;
+};
+std::vector<RenderTarget> _targets;
+RenderGraph _graph;
+GLuint _noiseTexture = 0;
+TextureStreamer _textures;
+
+// Render scale of each level relative to the maximum scale, largest first.
+static const float _scaleLevels[] = { 1.0f, 0.85f, 0.7f, 0.6f, 0.5f, 0.4f };
+static const int _numScaleLevels = 
+    sizeof(_scaleLevels) / sizeof(_scaleLevels[0]);
+
+// PI is a nice aspect ratio
+static const float _imageAspect = 3.14159265359f;
+
+//
+// Formats for the frame textures. They are written once by the dunes pass
+// and sampled several times per pixel by the film pass, so their size is
+// paid for mostly in film bandwidth. rgba8 is what the demo always used;
+// r11g11b10f keeps HDR range at the same 32 bits (without alpha, which
+// nothing reads), rgb10a2 trades alpha for precision and rgba16f doubles
+// the bandwidth for full half float precision.
+//
+struct FrameFormat {
+    char const* name;
+    GLenum format;
+};
+static const FrameFormat _frameFormats[] = {
+    { "rgba8",      GL_RGBA8 },
+    { "r11g11b10f", GL_R11F_G11F_B10F },
+    { "rgba16f",    GL_RGBA16F },
+    { "rgb10a2",    GL_RGB10_A2 },
+};
+static const int _numFrameFormats =
+    sizeof(_frameFormats) / sizeof(_frameFormats[0]);
 
 static void
-_InitFBO(GLsizei width, GLsizei height)
+_InitFrameTextures(RenderTarget* rt, GLenum format)
 {
-    glGenFramebuffers(1, &_fbo);
-    glGenRenderbuffers(1, &_rboDepth);
-    glGenRenderbuffers(1, &_rboColor);
-    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
-    
-    glBindRenderbuffer(GL_RENDERBUFFER, _rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width, height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                              GL_RENDERBUFFER, _rboDepth);
-
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _texBuffers[0], 0);
-    /*
-    glBindRenderbuffer(GL_RENDERBUFFER, _rboColor);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                              GL_RENDERBUFFER, _rboColor);
-    */
-
-    _GLCheckError("FBO");
-
-    switch (glCheckFramebufferStatus(GL_FRAMEBUFFER)) {
-    case GL_FRAMEBUFFER_COMPLETE:
-        break;
-    case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT: {
-        std::cerr << "Invalid frame buffer: Incomplete attachment\n";
-        exit(EXIT_FAILURE);
+    GLsizei width = rt->width, height = rt->height;
+    // Zero filled so the unrendered texels are deterministic; bytes convert
+    // to any of the formats and are a quarter the size of floats.
+    std::vector<unsigned char> zeros(width*height*4, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glGenTextures(2, &rt->texBuffers[0]);
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, rt->texBuffers[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        if (GLEW_ARB_texture_storage) {
+            glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA,
+                            GL_UNSIGNED_BYTE, &zeros[0]);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, &zeros[0]);
+        }
     }
-    case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT: {
-        std::cerr << "Invalid frame buffer: missing attachment\n";
-        exit(EXIT_FAILURE);
+
+    // Distances of 0 never move a ray's start, so even these are harmless
+    glGenTextures(2, &rt->hitBuffers[0]);
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, rt->hitBuffers[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        if (GLEW_ARB_texture_storage) {
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, width, height);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED,
+                            GL_UNSIGNED_BYTE, &zeros[0]);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED,
+                         GL_UNSIGNED_BYTE, &zeros[0]);
+        }
     }
-    case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER: {
-        std::cerr << "Invalid frame buffer: incomplete draw buffer\n";
-        exit(EXIT_FAILURE);
+    _GLCheckError("_InitFrameTextures");
+}
+
+//
+// Allocates a render target for each of the first numLevels scale levels.
+// The render resolution is the output width times the scale, with the height
+// derived from the (fixed) image aspect.
+//
+static void
+_InitRenderTargets(int width, float aspect, float scale, int numLevels,
+                   GLenum format)
+{
+    _targets.resize(numLevels);
+    for (int i = 0; i < numLevels; i++) {
+        RenderTarget* rt = &_targets[i];
+        float levelScale = scale * _scaleLevels[i];
+        rt->width = width*levelScale;
+        rt->height = (width*levelScale)*(1/aspect);
+        _InitFrameTextures(rt, format);
     }
-    case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER: {
-        std::cerr << "Invalid frame buffer: incomplete read buffer\n";
-        exit(EXIT_FAILURE);
+}
+
+static void
+_FreeRenderTargets()
+{
+    // Cached framebuffers may refer to the frame textures
+    _graph.Trim();
+    for (size_t i = 0; i < _targets.size(); i++) {
+        glDeleteTextures(2, _targets[i].texBuffers);
+        glDeleteTextures(2, _targets[i].hitBuffers);
     }
-    case GL_FRAMEBUFFER_UNSUPPORTED: {
-        std::cerr << "Invalid frame buffer: unsupported\n";
-        exit(EXIT_FAILURE);
+    _targets.clear();
+}
+
+/* -------------------------------------------------------------------------- */
+/* FRAME                                                                      */
+/* -------------------------------------------------------------------------- */
+
+//
+// The heightfield covers 4096 world units, a little more than the dunes
+// shader's 2000 unit draw distance either side of the camera, and is
+// centered ahead of it so the whole view stays inside. Its texels are 2
+// units across, several per noise cell of the terrain.
+//
+static const int _HeightfieldSize = 2048;
+static const float _HeightfieldTexel = 2.0f;
+static const float _HeightfieldLead = 512.0f;
+
+//
+// The sun's shadow is baked over the same tile, at most this many texels a
+// frame: a strip the width of a heightfield snap, so keeping up with the
+// tile takes a frame per move, and filling it from scratch about 16.
+//
+static const int _SunShadowBudget = 128 * _HeightfieldSize;
+
+//
+// Before the dunes pass, a cone is marched for each tile of this many
+// pixels squared, so the full resolution rays start where their tile's cone
+// first came close to anything instead of at the camera. Matches coneTile in
+// dunes.fs.glsl.
+//
+static const int _ConeTile = 4;
+
+//
+// Rays also start from where the previous frame's rays hit, reprojected, as
+// long as it rendered the same target without interleaving and not too far
+// back in time (e.g. before a seek). See warmStart in dunes.fs.glsl.
+//
+static const double _MaxWarmStartSeconds = 0.1;
+GLuint _lastHitBuffer = 0;
+double _lastTime = 0;
+
+// Mirrors the camera time in main() of dunes.fs.glsl.
+static float
+_ShaderTime(float globalTime, float width)
+{
+    return globalTime*0.15f + 0.3f + 4.0f/width;
+}
+
+// Mirrors camPath in dunes.fs.glsl.
+static void
+_CamPath(float time, float pos[3])
+{
+    time -= 0.5f;
+    pos[0] = time * 1500.0f;
+    pos[1] = std::sin(time*10.0f)*30.0f + 30.0f;
+    pos[2] = time * 1000.0f;
+}
+
+static void
+_RenderFrame(Timeline::Sample const & now, int width, int height,
+             RenderTarget const & target, bool interleave)
+{
+    // Frames alternate frame textures; with interleaving, the dunes pass
+    // only shades the field matching the current buffer and the film pass
+    // fills in the other field from the previous frame.
+    int cur = now.frame & 1, prev = cur ^ 1;
+    int field = interleave ? cur + 1 : 0;
+
+    GLsizei widthFbo = target.width, heightFbo = target.height;
+    // Everything both passes need, written once and fenced after the film
+    // pass, so the CPU may run up to UniformRing::Depth frames ahead.
+    FrameConstants* fc = (FrameConstants*)_frameConstants.BeginFrame();
+    Audio& audio = Audio::Get();
+    audio.SetTime(now.time);
+    fc->iResolution[0] = widthFbo;
+    fc->iResolution[1] = heightFbo;
+    fc->iResolution[2] = 1.0f;
+    fc->iGlobalTime = now.time;
+    fc->iViewport[0] = width;
+    fc->iViewport[1] = height;
+    fc->iRandom = (now.seed >> 8) / float(1 << 24);
+    fc->iInterleave = field;
+    fc->iAudio[0] = audio.GetKicks();
+    fc->iAudio[1] = audio.GetSnares();
+    fc->iAudio[2] = audio.GetHiHats();
+    fc->iAudio[3] = audio.GetWind();
+
+    // Keep the heightfield ahead of the camera, which looks along its path
+    float time = _ShaderTime(now.time, widthFbo);
+    float eye[3], ahead[3];
+    _CamPath(time, eye);
+    _CamPath(time + 3.0f, ahead);
+    float dx = ahead[0] - eye[0], dz = ahead[2] - eye[2];
+    float lead = _HeightfieldLead / std::max(std::sqrt(dx*dx + dz*dz), 1e-3f);
+    bool bake = _heightfield.Update(eye[0] + dx*lead, eye[2] + dz*lead);
+    fc->iTerrain[0] = _heightfield.GetOriginX();
+    fc->iTerrain[1] = _heightfield.GetOriginZ();
+    fc->iTerrain[2] = _heightfield.GetTexelSize();
+    fc->iTerrain[3] = _heightfield.GetLevels();
+    std::vector<SunShadow::Rect> shadowBakes;
+    _sunShadow.Update(_heightfield.GetOriginX(), _heightfield.GetOriginZ(),
+                      eye[0], eye[2], _SunShadowBudget, &shadowBakes);
+    SunShadow::Rect const & baked = _sunShadow.GetBaked();
+    fc->iSunShadow[0] = baked.x0;
+    fc->iSunShadow[1] = baked.z0;
+    fc->iSunShadow[2] = baked.x1;
+    fc->iSunShadow[3] = baked.z1;
+    bool warmStart = not interleave
+        and _lastHitBuffer == target.hitBuffers[prev]
+        and std::abs(now.time - _lastTime) < _MaxWarmStartSeconds;
+    fc->iHistory[0] = _lastTime;
+    fc->iHistory[1] = warmStart ? 1.0f : 0.0f;
+    fc->iHistory[2] = 0.0f;
+    fc->iHistory[3] = 0.0f;
+    _frameConstants.Bind(_FrameConstantsBinding);
+
+    //
+    // Declare the frame. The graph binds inputs and targets before each pass
+    // and skips whatever is already bound, so the passes only draw.
+    //
+    _graph.Begin();
+    RenderGraph::Resource noise = _graph.Import("noise", _noiseTexture,
+                                                256, 256);
+    RenderGraph::Resource scene = _graph.Import("scene",
+                                                target.texBuffers[cur],
+                                                widthFbo, heightFbo);
+    RenderGraph::Resource history = _graph.Import("history",
+                                                  target.texBuffers[prev],
+                                                  widthFbo, heightFbo);
+    RenderGraph::Resource hits = _graph.Import("hits", target.hitBuffers[cur],
+                                               widthFbo, heightFbo);
+    RenderGraph::Resource lastHits = _graph.Import("last hits",
+                                                   target.hitBuffers[prev],
+                                                   widthFbo, heightFbo);
+    RenderGraph::Resource screen = _graph.ImportBackbuffer(width, height);
+
+    RenderGraph::Resource terrain = _graph.Import("terrain",
+                                                  _heightfield.GetTexture(),
+                                                  _heightfield.GetSize(),
+                                                  _heightfield.GetSize(),
+                                                  _heightfield.GetLevels());
+
+    // Re-bake the heightfield when it moved: heights into level 0, then
+    // each level the max of the one below.
+    if (bake) {
+        int heights = _graph.AddPass("bake heights", []() {
+            _gpuTimer.Begin(_GpuTerrain);
+            glUseProgram(_shaderToy.program);
+            _SetQuadPass(_shaderToy, _BakeHeightsPass);
+            glDrawArrays(GL_TRIANGLES, 0, 3*2);
+        });
+        _graph.Read(heights, noise, 0);
+        _graph.Write(heights, terrain, RenderGraph::DontCare);
+
+        int levels = _heightfield.GetLevels();
+        for (int level = 1; level < levels; level++) {
+            bool last = level == levels - 1;
+            int reduce = _graph.AddPass("reduce heights", [last]() {
+                glUseProgram(_shaderToy.program);
+                _SetQuadPass(_shaderToy, _ReduceHeightsPass);
+                glDrawArrays(GL_TRIANGLES, 0, 3*2);
+                if (last)
+                    _gpuTimer.End(_GpuTerrain);
+            });
+            _graph.ReadLevel(reduce, terrain, 3, level - 1);
+            _graph.Write(reduce, terrain, RenderGraph::DontCare, level);
+        }
     }
-    default:
-        exit(EXIT_FAILURE);
+
+    RenderGraph::Resource sunShadow = _graph.Import("sun shadow",
+                                                    _sunShadow.GetTexture(),
+                                                    _sunShadow.GetSize(),
+                                                    _sunShadow.GetSize());
+
+    // Bake the sun's shadow where it is missing, the rest of the texture
+    // is kept
+    if (not shadowBakes.empty()) {
+        int shadows = _graph.AddPass("bake sun shadow", [shadowBakes]() {
+            _gpuTimer.Begin(_GpuSunShadow);
+            glUseProgram(_shaderToy.program);
+            _SetQuadPass(_shaderToy, _BakeShadowPass);
+            glEnable(GL_SCISSOR_TEST);
+            for (size_t i = 0; i < shadowBakes.size(); i++) {
+                SunShadow::Rect const & r = shadowBakes[i];
+                glScissor(r.x0, r.z0, r.x1 - r.x0, r.z1 - r.z0);
+                glDrawArrays(GL_TRIANGLES, 0, 3*2);
+            }
+            glDisable(GL_SCISSOR_TEST);
+            _gpuTimer.End(_GpuSunShadow);
+        });
+        _graph.Read(shadows, noise, 0);
+        _graph.Read(shadows, terrain, 3);
+        _graph.Write(shadows, sunShadow, RenderGraph::Load);
     }
 
+    // Timed with the dunes pass, it only exists to speed that up
+    RenderGraph::TextureDesc coneDesc = {
+        (widthFbo + _ConeTile - 1) / _ConeTile,
+        (heightFbo + _ConeTile - 1) / _ConeTile, GL_R32F };
+    RenderGraph::Resource coneDepth = _graph.Create("cone depth", coneDesc);
+    int cone = _graph.AddPass("cone depth", []() {
+        _gpuTimer.Begin(_GpuDunes);
+        glUseProgram(_shaderToy.program);
+        _SetQuadPass(_shaderToy, _ConeDepthPass);
+        glDrawArrays(GL_TRIANGLES, 0, 3*2);
+    });
+    _graph.Read(cone, noise, 0);
+    _graph.Read(cone, terrain, 3);
+    _graph.Write(cone, coneDepth, RenderGraph::DontCare);
+
+    int dunes = _graph.AddPass("dunes", []() {
+        glUseProgram(_shaderToy.program);
+        _SetQuadPass(_shaderToy, _ShadePass);
+        glDrawArrays(GL_TRIANGLES, 0, 3*2);
+        _gpuTimer.End(_GpuDunes);
+        _GLCheckError("draw");
+    });
+    // Both passes write every pixel they later read (with interleaving,
+    // the skipped field is never sampled), so the old contents are dead.
+    _graph.Read(dunes, noise, 0);
+    _graph.Read(dunes, coneDepth, 1);
+    _graph.Read(dunes, lastHits, 2);
+    _graph.Read(dunes, terrain, 3);
+    _graph.Read(dunes, sunShadow, 4);
+    _graph.Write(dunes, scene, RenderGraph::DontCare);
+    _graph.Write(dunes, hits, RenderGraph::DontCare);
+
+    // Apply film effect and blit to screen
+    int film = _graph.AddPass("film", []() {
+        _gpuTimer.Begin(_GpuFilm);
+        glUseProgram(_film.program);
+        glDrawArrays(GL_TRIANGLES, 0, 3*2);
+        _gpuTimer.End(_GpuFilm);
+        _GLCheckError("draw2");
+    });
+    _graph.Read(film, noise, 0);
+    _graph.Read(film, scene, 1);
+    _graph.Read(film, history, 2);
+    _graph.Write(film, screen, RenderGraph::DontCare);
+
+    _graph.Execute();
+    _frameConstants.EndFrame();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    _lastHitBuffer = target.hitBuffers[cur];
+    _lastTime = now.time;
 }
 
+/* -------------------------------------------------------------------------- */
+/* MAIN                                                                       */
+/* -------------------------------------------------------------------------- */
+
+struct Options {
+    // Render offscreen through EGL and dump every frame to disk.
+    bool headless;
+
+    // Output resolution, only used in headless mode; windowed mode always
+    // uses the native resolution of the primary monitor.
+    int width;
+    int height;
+
+    // Number of frames to render for headless runs, and the timestep rate
+    // whenever the timeline is fixed-step.
+    int frames;
+    double fps;
+
+    // How demo time advances in windowed mode (headless is always fixed
+    // step) and where it starts, in seconds.
+    Timeline::Mode timeline;
+    double start;
+
+    // Play the soundtrack, windowed mode only.
+    bool audio;
+
+    // Windowed mode latency: how many frames the GPU may queue (1-3), and
+    // an optional frame rate cap (zero for none).
+    int framesInFlight;
+    double fpsCap;
+
+    // Frame N is written to <outPrefix>_NNNNN.png, empty disables writing.
+    // A prefix ending in .y4m writes a single Y4M stream instead.
+    std::string outPrefix;
+
+    // Records the windowed run the same way, dropping frames rather than
+    // slowing down; empty disables recording.
+    std::string capturePath;
+
+    // Per-frame CPU/GPU timings are logged here when non-empty.
+    std::string csvPath;
+
+    // Render resolution as a fraction of the output width. With a GPU
+    // budget (ms) this is the upper bound and the render scale drops as
+    // needed to stay within the budget; zero disables dynamic resolution.
+    float scale;
+    double budgetMs;
+
+    // Shade half of the dunes pass each frame, reconstructing the other half
+    // from the previous frame.
+    bool interleave;
+
+    // Index into _frameFormats for the dunes pass output.
+    int frameFormat;
+
+    // Linked program binaries are cached here, empty disables the cache.
+    std::string shaderCacheDir;
+
+    // Packed assets (see tools/pack.cpp), used in place of the loose files
+    // when present; empty disables the archive.
+    std::string assetsPath;
+
+    // Relink shaders in the background when their files change.
+    bool watch;
+
+    // Offscreen sweep over every bench size and scale, written to benchPath
+    // as JSON. Each configuration renders warmup unmeasured frames, then
+    // the measured ones.
+    bool bench;
+    std::vector<std::pair<int, int> > benchSizes;
+    std::vector<float> benchScales;
+    int warmup;
+    std::string benchPath;
+
+    // Start-up and the traced frames (inclusive ranges) are written here as
+    // Chrome trace_event JSON when non-empty.
+    std::string tracePath;
+    std::vector<std::pair<int, int> > traceFrames;
+
+    Options() : headless(false), width(1280), height(720), frames(300),
+                fps(60.0), timeline(Timeline::RealTime), start(0),
+                audio(false), framesInFlight(2), fpsCap(0),
+                outPrefix("frame"), scale(0.5), budgetMs(0),
+                interleave(false), frameFormat(0),
+                shaderCacheDir(".shadercache"), assetsPath("assets.pak"),
+                watch(false), bench(false), warmup(30),
+                benchPath("bench.json")
+    {
+        benchSizes.push_back(std::make_pair(1280, 720));
+        benchSizes.push_back(std::make_pair(1920, 1080));
+        benchSizes.push_back(std::make_pair(2560, 1440));
+        benchScales.push_back(0.5f);
+        benchScales.push_back(0.75f);
+        benchScales.push_back(1.0f);
+        traceFrames.push_back(std::make_pair(0, 0));
+    }
+};
+
 static void
-_InitRandomTexture()
+_Usage(char const* argv0)
 {
-    std::vector<unsigned char> data;
-    std::vector<unsigned char> image; //the raw pixels
-    unsigned width, height;
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "  --headless       render offscreen and write frames\n"
+              << "  --size WxH       headless output size (1280x720)\n"
+              << "  --frames N       headless frame count (300)\n"
+              << "  --fps F          fixed timestep rate (60)\n"
+              << "  --timeline MODE  realtime, fixed or scrub (realtime)\n"
+              << "  --start S        start time in seconds (0)\n"
+              << "  --audio          play the soundtrack\n"
+              << "  --frames-in-flight N  frames the GPU may queue, 1-3 (2)\n"
+              << "  --fps-cap F      limit the windowed frame rate\n"
+              << "  --out PREFIX     headless output prefix (frame), \"\" for none\n"
+              << "  --capture PATH   record the windowed run (PNG prefix or .y4m) at\n"
+              << "                   --fps, on the fixed timeline when realtime\n"
+              << "  --csv PATH       log per-frame CPU/GPU times as CSV\n"
+              << "  --scale S        (maximum) render scale (0.5)\n"
+              << "  --budget MS      scale resolution to fit a GPU budget\n"
+              << "  --interleave     checkerboard render the dunes pass\n"
+              << "  --format F       frame texture format: rgba8, r11g11b10f,\n"
+              << "                   rgba16f or rgb10a2 (rgba8)\n"
+              << "  --shader-cache DIR  program binary cache (.shadercache), \"\" for none\n"
+              << "  --assets PATH    packed asset archive (assets.pak), \"\" for none\n"
+              << "  --watch          hot reload shaders when they change\n"
+              << "  --bench          time a sweep of sizes and scales offscreen\n"
+              << "  --bench-sizes L  comma separated WxH list (1280x720,1920x1080,2560x1440)\n"
+              << "  --bench-scales L comma separated scale list (0.5,0.75,1)\n"
+              << "  --warmup N       unmeasured frames per bench configuration (30)\n"
+              << "  --bench-out PATH bench results as JSON (bench.json)\n"
+              << "  --trace PATH     write a Chrome trace of start-up and frames\n"
+              << "  --trace-frames L comma separated frames or ranges to trace,\n"
+              << "                   e.g. 0,100-102 (0)\n";
+    exit(EXIT_FAILURE);
+}
+
+// Parses "1280x720,1920x1080", returns false on anything malformed.
+static bool
+_ParseSizeList(std::string const & list,
+               std::vector<std::pair<int, int> >* sizes)
+{
+    sizes->clear();
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int width = 0, height = 0;
+        if (sscanf(item.c_str(), "%dx%d", &width, &height) != 2
+            or width <= 0 or height <= 0)
+            return false;
+        sizes->push_back(std::make_pair(width, height));
+    }
+    return not sizes->empty();
+}
+
+// Parses "0,100-102" into inclusive ranges, false on anything malformed.
+static bool
+_ParseFrameList(std::string const & list,
+                std::vector<std::pair<int, int> >* ranges)
+{
+    ranges->clear();
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int first = 0, last = 0;
+        int n = sscanf(item.c_str(), "%d-%d", &first, &last);
+        if (n == 1)
+            last = first;
+        if (n < 1 or first < 0 or last < first)
+            return false;
+        ranges->push_back(std::make_pair(first, last));
+    }
+    return not ranges->empty();
+}
+
+static bool
+_ParseScaleList(std::string const & list, std::vector<float>* scales)
+{
+    scales->clear();
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        float scale = atof(item.c_str());
+        if (scale <= 0)
+            return false;
+        scales->push_back(scale);
+    }
+    return not scales->empty();
+}
+
+static void
+_ParseArgs(int argc, char** argv, Options* opts)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless") {
+            opts->headless = true;
+        } else if (arg == "--size" and hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &opts->width, &opts->height) != 2
+                or opts->width <= 0 or opts->height <= 0)
+                _Usage(argv[0]);
+        } else if (arg == "--frames" and hasValue) {
+            opts->frames = atoi(argv[++i]);
+            if (opts->frames < 1)
+                _Usage(argv[0]);
+        } else if (arg == "--fps" and hasValue) {
+            opts->fps = atof(argv[++i]);
+            if (opts->fps <= 0)
+                _Usage(argv[0]);
+        } else if (arg == "--timeline" and hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "realtime")
+                opts->timeline = Timeline::RealTime;
+            else if (mode == "fixed")
+                opts->timeline = Timeline::FixedStep;
+            else if (mode == "scrub")
+                opts->timeline = Timeline::Scrub;
+            else
+                _Usage(argv[0]);
+        } else if (arg == "--start" and hasValue) {
+            opts->start = atof(argv[++i]);
+        } else if (arg == "--audio") {
+            opts->audio = true;
+        } else if (arg == "--frames-in-flight" and hasValue) {
+            opts->framesInFlight = atoi(argv[++i]);
+            if (opts->framesInFlight < 1
+                or opts->framesInFlight > FramePacer::MaxFramesInFlight)
+                _Usage(argv[0]);
+        } else if (arg == "--fps-cap" and hasValue) {
+            opts->fpsCap = atof(argv[++i]);
+        } else if (arg == "--out" and hasValue) {
+            opts->outPrefix = argv[++i];
+        } else if (arg == "--capture" and hasValue) {
+            opts->capturePath = argv[++i];
+        } else if (arg == "--csv" and hasValue) {
+            opts->csvPath = argv[++i];
+        } else if (arg == "--scale" and hasValue) {
+            opts->scale = atof(argv[++i]);
+            if (opts->scale <= 0)
+                _Usage(argv[0]);
+        } else if (arg == "--budget" and hasValue) {
+            opts->budgetMs = atof(argv[++i]);
+        } else if (arg == "--interleave") {
+            opts->interleave = true;
+        } else if (arg == "--format" and hasValue) {
+            std::string name = argv[++i];
+            opts->frameFormat = -1;
+            for (int f = 0; f < _numFrameFormats; f++) {
+                if (name == _frameFormats[f].name)
+                    opts->frameFormat = f;
+            }
+            if (opts->frameFormat < 0)
+                _Usage(argv[0]);
+        } else if (arg == "--shader-cache" and hasValue) {
+            opts->shaderCacheDir = argv[++i];
+        } else if (arg == "--assets" and hasValue) {
+            opts->assetsPath = argv[++i];
+        } else if (arg == "--watch") {
+            opts->watch = true;
+        } else if (arg == "--bench") {
+            opts->bench = true;
+        } else if (arg == "--bench-sizes" and hasValue) {
+            if (not _ParseSizeList(argv[++i], &opts->benchSizes))
+                _Usage(argv[0]);
+        } else if (arg == "--bench-scales" and hasValue) {
+            if (not _ParseScaleList(argv[++i], &opts->benchScales))
+                _Usage(argv[0]);
+        } else if (arg == "--warmup" and hasValue) {
+            opts->warmup = atoi(argv[++i]);
+            if (opts->warmup < 0)
+                _Usage(argv[0]);
+        } else if (arg == "--bench-out" and hasValue) {
+            opts->benchPath = argv[++i];
+        } else if (arg == "--trace" and hasValue) {
+            opts->tracePath = argv[++i];
+        } else if (arg == "--trace-frames" and hasValue) {
+            if (not _ParseFrameList(argv[++i], &opts->traceFrames))
+                _Usage(argv[0]);
+        } else {
+            _Usage(argv[0]);
+        }
+    }
+}
+
+static bool
+_IsTracedFrame(Options const & opts, size_t frame)
+{
+    for (size_t i = 0; i < opts.traceFrames.size(); i++) {
+        if (frame >= size_t(opts.traceFrames[i].first)
+            and frame <= size_t(opts.traceFrames[i].second))
+            return true;
+    }
+    return false;
+}
+
+// False if GL, GLEW or the shaders failed, see _glFailed.
+static bool
+_InitScene(Options const & opts, int width)
+{
+    TraceScope scope("init scene");
+    GLint major=0, minor=0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    _GLCheckError("Check version");
+    std::cout << "OpenGL " << major << "." << minor << std::endl;
+
+    {
+        TraceScope scope("glew init");
+        _GLEWInit();
+    }
+    if (_glFailed)
+        return false;
+
+    // Decodes on the workers while the shaders compile
+    _textures.SetArchive(&_assets);
+    _textures.Start(std::min(std::max(
+        int(std::thread::hardware_concurrency()) - 1, 1), 4));
+    _noiseTexture = _textures.Load("tex12.png", LCT_GREY, GL_NEAREST,
+                                   GL_REPEAT);
+    SetShaderCacheDir(opts.shaderCacheDir);
+    {
+        TraceScope scope("gl init");
+        _GLInit();                        // compiles run in the background
+    }
+    {
+        TraceScope scope("frame textures");
+        _InitRenderTargets(width, _imageAspect, opts.scale,
+                           opts.budgetMs > 0 ? _numScaleLevels : 1,
+                           _frameFormats[opts.frameFormat].format);
+    }
+    _gpuTimer.Init();
+    _frameConstants.Init(sizeof(FrameConstants));
+    _heightfield.Init(_HeightfieldSize, _HeightfieldTexel);
+    _sunShadow.Init(_HeightfieldSize, _HeightfieldTexel);
+
+    // Collect whichever program finishes first, without blocking on the
+    // other, and upload the textures as they come in. Without the extension
+    // the programs are simply sequential.
+    TraceScope linkScope("wait for programs and textures");
+    bool shaderToyDone = false, filmDone = false;
+    while (not shaderToyDone or not filmDone or _textures.IsBusy()) {
+        _textures.Update();
+        if (not shaderToyDone and _GLIsProgramReady(_pendingShaderToy)) {
+            _FinishLinkQuadProgram(&_pendingShaderToy, &_shaderToy);
+            shaderToyDone = true;
+        } else if (not filmDone and _GLIsProgramReady(_pendingFilm)) {
+            _FinishLinkQuadProgram(&_pendingFilm, &_film);
+            filmDone = true;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    return not _glFailed;
+}
 
-    // decode
-    lodepng::load_file(data, "tex12.png");
-    unsigned error = lodepng::decode(image, width, height, data, LCT_GREY, 8);
+static ResolutionController
+_MakeResolutionController(Options const & opts)
+{
+    std::vector<double> pixels;
+    for (size_t i = 0; i < _targets.size(); i++)
+        pixels.push_back(double(_targets[i].width) * _targets[i].height);
+    return ResolutionController(pixels, opts.budgetMs);
+}
+
+static void
+_DrainGpuTimer(FrameStats* stats, ResolutionController* dynres)
+{
+    GpuTimer::Frame gpu;
+    while (_gpuTimer.PopFrame(&gpu)) {
+        stats->AddGpuFrame(gpu);
+        dynres->AddGpuFrame(gpu.index, gpu.ms[_GpuDunes], gpu.ms[_GpuFilm]);
+    }
+}
 
-    // if there's an error, display it
-    if(error) 
-        std::cerr << "decoder error " << error << ": " 
-                  << lodepng_error_text(error) << std::endl;
+//
+// Renders a fixed number of frames at a fixed timestep into an offscreen
+// context, so runs are repeatable and don't need a display.
+//
+static int
+_RunHeadless(Options const & opts)
+{
+    {
+        TraceScope scope("create context");
+        if (not CreateHeadlessContext(opts.width, opts.height))
+            return EXIT_FAILURE;
+    }
 
-    //the pixels are now in the vector "image", 4 bytes per pixel, ordered
-    //RGBARGBA..., use it as texture, draw it, ...
+    if (not _InitScene(opts, opts.width))
+        return EXIT_FAILURE;
+    ResolutionController dynres = _MakeResolutionController(opts);
+
+    if (opts.watch and CreateHeadlessSharedContext())
+        _reloader.Start(MakeHeadlessSharedContextCurrent,
+                        ReleaseHeadlessSharedContext);
+
+    // Bit-reproducible: frame N is always rendered at start + N/fps
+    _timeline.SetMode(Timeline::FixedStep);
+    _timeline.SetFps(opts.fps);
+    _timeline.Seek(opts.start);
+
+    FrameStats stats(opts.frames, _GpuScopeNames());
+    if (not opts.csvPath.empty() and not stats.OpenCsv(opts.csvPath))
+        return EXIT_FAILURE;
+
+    // Offline, so keep every frame; encoding still overlaps rendering.
+    FrameCapture capture;
+    if (not opts.outPrefix.empty()
+        and not capture.Open(opts.outPrefix, opts.width, opts.height,
+                             opts.fps, /*lossless*/true))
+        return EXIT_FAILURE;
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    int lastLevel = -1;
+    for (int frame = 0; frame < opts.frames; frame++) {
+        SetTraceRecording(_IsTracedFrame(opts, frame));
+        TraceScope frameScope("frame", frame);
+        Clock::time_point frameStart = Clock::now();
+        _UpdateReloadedPrograms();
+        _textures.Update();
+        Timeline::Sample now = _timeline.Advance();
+        int level = dynres.Update(frame);
+        RenderTarget const & target = _targets[level];
+
+        // The previous frame is only usable if it went to the same target
+        bool interleave = opts.interleave and level == lastLevel;
+        lastLevel = level;
+
+        _gpuTimer.BeginFrame();
+        _RenderFrame(now, opts.width, opts.height, target, interleave);
+        _gpuTimer.EndFrame();
+        if (_glFailed)
+            break;
+
+        {
+            TraceScope scope("capture");
+            capture.Capture(now.frame);
+        }
+        PollTraceGpu();
 
-    GLuint tex = 0;
-    glGenTextures(1, &tex);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        stats.AddCpuFrame(frame, std::chrono::duration<double, std::milli>(
+                                     Clock::now() - frameStart).count());
+        _DrainGpuTimer(&stats, &dynres);
+    }
+    capture.Close();
+    glFinish();
+    double elapsed = std::chrono::duration<double>(
+        Clock::now() - start).count();
+    _gpuTimer.Flush();
+    _DrainGpuTimer(&stats, &dynres);
+    stats.Flush();
+
+    if (not _glFailed) {
+        std::cout << "Rendered " << opts.frames << " frames in " << elapsed
+                  << "s (" << (opts.frames / elapsed) << " FPS)\n";
+        stats.Report(std::cout);
+    }
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, width, height, 0, GL_RED,
-                 GL_UNSIGNED_BYTE, &image[0]);
+    _reloader.Stop();
+    _textures.Stop();
+    StopTrace();
+    DestroyHeadlessContext();
+    return _glFailed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
+//
+// Drains the GPU timer into the bench stats, dropping the warm-up frames.
+//
 static void
-_InitFrameTextures(GLsizei width, GLsizei height)
+_DrainBenchTimer(FrameStats* stats, size_t firstMeasured)
 {
-    glActiveTexture(GL_TEXTURE1);
-    glGenTextures(2, &_texBuffers[0]);
-    float* mem = new float(width*height*sizeof(float)*4);
-    glBindTexture(GL_TEXTURE_2D, _texBuffers[0]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
-                 GL_FLOAT, mem);
-
-    glBindTexture(GL_TEXTURE_2D, _texBuffers[1]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
-                 GL_FLOAT, mem);
+    GpuTimer::Frame gpu;
+    while (_gpuTimer.PopFrame(&gpu)) {
+        if (gpu.index >= firstMeasured)
+            stats->AddGpuFrame(gpu);
+    }
+}
 
+static void
+_WriteBenchStat(std::ostream & out, char const* name,
+                FrameHistogram const & hist)
+{
+    out << "\"" << name << "\": { \"mean\": " << hist.Mean()
+        << ", \"p99\": " << hist.Percentile(0.99) << " }";
 }
 
-/* -------------------------------------------------------------------------- */
-/* MAIN                                                                       */
-/* -------------------------------------------------------------------------- */
+// A JSON string's contents, quotes and backslashes escaped.
+static std::string
+_JsonEscape(char const* str)
+{
+    std::string escaped;
+    for (; str and *str; str++) {
+        if (*str == '"' or *str == '\\')
+            escaped += '\\';
+        escaped += *str;
+    }
+    return escaped;
+}
+
+//
+// Renders the same fixed-step frames at every output size and render scale
+// and writes the timings as JSON. Runs offscreen so there is no vsync or
+// compositor in the way; the pbuffer is allocated at the largest size and
+// smaller sizes just use part of it.
+//
+static int
+_RunBench(Options const & opts)
+{
+    int maxWidth = 0, maxHeight = 0;
+    for (size_t i = 0; i < opts.benchSizes.size(); i++) {
+        maxWidth = std::max(maxWidth, opts.benchSizes[i].first);
+        maxHeight = std::max(maxHeight, opts.benchSizes[i].second);
+    }
+    if (not CreateHeadlessContext(maxWidth, maxHeight))
+        return EXIT_FAILURE;
+    if (not _InitScene(opts, opts.benchSizes[0].first))
+        return EXIT_FAILURE;
+
+    // Only start-up is traced, the sweep is what the JSON is for
+    SetTraceRecording(false);
+
+    std::ofstream json(opts.benchPath.c_str());
+    if (not json) {
+        std::cerr << "Failed to open " << opts.benchPath << "\n";
+        return EXIT_FAILURE;
+    }
+    json << "{\n"
+         << "  \"renderer\": \""
+         << _JsonEscape((char const*)glGetString(GL_RENDERER)) << "\",\n"
+         << "  \"frames\": " << opts.frames << ",\n"
+         << "  \"warmup\": " << opts.warmup << ",\n"
+         << "  \"fps\": " << opts.fps << ",\n"
+         << "  \"start\": " << opts.start << ",\n"
+         << "  \"interleave\": " << (opts.interleave ? "true" : "false")
+         << ",\n"
+         << "  \"format\": \"" << _frameFormats[opts.frameFormat].name
+         << "\",\n"
+         << "  \"configs\": [";
+
+    _timeline.SetMode(Timeline::FixedStep);
+    _timeline.SetFps(opts.fps);
+
+    typedef std::chrono::steady_clock Clock;
+    size_t frame = 0;               // in step with the GpuTimer frame index
+    char const* separator = "\n";
+    size_t numScales = opts.benchScales.size();
+    size_t numConfigs = opts.benchSizes.size() * numScales;
+    for (size_t c = 0; c < numConfigs; c++) {
+        int width = opts.benchSizes[c / numScales].first;
+        int height = opts.benchSizes[c / numScales].second;
+        float scale = opts.benchScales[c % numScales];
+
+        _FreeRenderTargets();
+        _InitRenderTargets(width, _imageAspect, scale, 1,
+                           _frameFormats[opts.frameFormat].format);
+        RenderTarget const & target = _targets[0];
+
+        // Every configuration renders exactly the same frames
+        _timeline.Seek(opts.start);
+        FrameStats stats(opts.frames, _GpuScopeNames());
+        size_t first = frame + opts.warmup;
+        size_t end = first + opts.frames;
+
+        Clock::time_point start = Clock::now();
+        for (size_t f = frame; f < end; f++) {
+            if (f == first) {
+                glFinish();
+                start = Clock::now();
+            }
+            Clock::time_point frameStart = Clock::now();
+            Timeline::Sample now = _timeline.Advance();
+            bool interleave = opts.interleave and f > frame;
+
+            _gpuTimer.BeginFrame();
+            _RenderFrame(now, width, height, target, interleave);
+            _gpuTimer.EndFrame();
+            if (_glFailed)
+                return EXIT_FAILURE;
+
+            if (f >= first) {
+                stats.AddCpuFrame(f, std::chrono::duration<double,
+                                  std::milli>(Clock::now() - frameStart)
+                                  .count());
+            }
+            _DrainBenchTimer(&stats, first);
+        }
+        glFinish();
+        double wallMs = std::chrono::duration<double, std::milli>(
+            Clock::now() - start).count() / opts.frames;
+        _gpuTimer.Flush();
+        _DrainBenchTimer(&stats, first);
+        frame = end;
+
+        // Interleaving shades half of these per frame, this is the rate at
+        // which finished pixels come out of the pass either way.
+        FrameHistogram const & dunes = stats.GetGpuScope(_GpuDunes);
+        double pixels = double(target.width) * target.height;
+        double mpixPerSec = dunes.Mean() > 0
+                          ? pixels / (dunes.Mean() * 1000.0) : 0.0;
+
+        json << separator
+             << "    {\n"
+             << "      \"width\": " << width
+             << ", \"height\": " << height
+             << ", \"scale\": " << scale << ",\n"
+             << "      \"render_width\": " << target.width
+             << ", \"render_height\": " << target.height << ",\n"
+             << "      \"wall_ms\": " << wallMs << ",\n      ";
+        _WriteBenchStat(json, "cpu_ms", stats.GetCpu());
+        json << ",\n      ";
+        _WriteBenchStat(json, "gpu_ms", stats.GetGpu());
+        json << ",\n      ";
+        _WriteBenchStat(json, "dunes_ms", dunes);
+        json << ",\n      \"dunes_mpix_per_s\": " << mpixPerSec
+             << ",\n      ";
+        _WriteBenchStat(json, "composite_ms", stats.GetGpuScope(_GpuFilm));
+        json << ",\n      \"gpu_frames\": " << stats.GetGpu().Count()
+             << "\n    }";
+        separator = ",\n";
+
+        std::cout << width << "x" << height << " @ " << scale
+                  << " (" << target.width << "x" << target.height << "): "
+                  << wallMs << " ms/frame, dunes " << mpixPerSec
+                  << " Mpix/s, composite "
+                  << stats.GetGpuScope(_GpuFilm).Mean() << " ms\n";
+    }
+    json << "\n  ]\n}\n";
+    std::cout << "Wrote " << opts.benchPath << std::endl;
 
-int main(void)
+    _textures.Stop();
+    StopTrace();
+    DestroyHeadlessContext();
+    return EXIT_SUCCESS;
+}
+
+//
+// Windowed rendering, on its own thread so neither event processing nor a
+// blocking swap holds the other up. The context is made current here and
+// stays here; input arrives through _input. Failures, including GL and shader
+// errors, are left in status and close the window, so the main thread still
+// tears down in order.
+//
+static void
+_RenderThread(Options const & opts, GLFWwindow* window,
+              GLFWwindow* reloadWindow, int width, int height, int* status)
 {
+    SetTraceThreadName("render");
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+
+    bool ok = _InitScene(opts, width);
+    ResolutionController dynres = _MakeResolutionController(opts);
+
+    if (reloadWindow and ok) {
+        _reloader.Start([reloadWindow]() {
+                            glfwMakeContextCurrent(reloadWindow);
+                        },
+                        []() { glfwMakeContextCurrent(NULL); });
+    }
+
+    //
+    // A capture is played back at opts.fps, so a real-time run is recorded
+    // on the fixed timestep instead: every captured frame then advances the
+    // timeline by exactly one frame of the recording, however long it took.
+    //
+    Timeline::Mode mode = opts.timeline;
+    if (not opts.capturePath.empty() and mode == Timeline::RealTime)
+        mode = Timeline::FixedStep;
+    _timeline.SetMode(mode);
+    _timeline.SetFps(opts.fps);
+    _timeline.Seek(opts.start);
+    if (opts.audio) {
+        TraceScope scope("start audio");
+        AssetArchive::Span ogg = { NULL, 0 };
+        _assets.Find("audio.ogg", &ogg);
+        StartAudio(ogg.data, ogg.size);
+    }
+    bool paused = false;
+
+    // Keep roughly the last ten seconds of frames for the percentiles
+    FrameStats stats(600, _GpuScopeNames());
+    ok = ok and (opts.csvPath.empty() or stats.OpenCsv(opts.csvPath));
+
+    double lastTime = glfwGetTime();
+    size_t frameCnt = 0;
+    int lastLevel = -1;
+
+    FrameCapture capture;
+    ok = ok and (opts.capturePath.empty()
+                 or capture.Open(opts.capturePath, width, height, opts.fps,
+                                 /*lossless*/false));
+    //std::cout << width << " x " << height << "\n";
+
+    // Swap interval 0 above, latency is bounded here instead
+    FramePacer pacer(opts.framesInFlight, opts.fpsCap);
+
+    while (ok and _ApplyInput())
+    {
+        SetTraceRecording(_IsTracedFrame(opts, frameCnt));
+        TraceScope frameScope("frame", frameCnt);
+        pacer.BeginFrame();
+        _UpdateReloadedPrograms();
+        _textures.Update();
+
+        // Audio follows the timeline, not the other way around
+        Timeline::Sample now = _timeline.Advance();
+        if (opts.audio) {
+            bool scrubbing = _timeline.GetMode() == Timeline::Scrub;
+            if (now.seeked)
+                SetAudioPosition(now.time);
+            if (scrubbing != paused)
+                PauseAudio(scrubbing);
+            paused = scrubbing;
+        }
+
+        int level = dynres.Update(frameCnt);
+        RenderTarget const & target = _targets[level];
+        bool interleave = opts.interleave and level == lastLevel;
+        lastLevel = level;
+
+        _gpuTimer.BeginFrame();
+        _RenderFrame(now, width, height, target, interleave);
+        _gpuTimer.EndFrame();
+        if (_glFailed)
+            break;
+
+        // The back buffer is undefined once swapped
+        capture.Capture(frameCnt);
+        {
+            TraceScope scope("swap");
+            glfwSwapBuffers(window);
+        }
+        pacer.EndFrame();
+        PollTraceGpu();
+
+        double frameEnd = glfwGetTime();
+        stats.AddCpuFrame(frameCnt, 1000.0 * (frameEnd - lastTime));
+        lastTime = frameEnd;
+        _DrainGpuTimer(&stats, &dynres);
+
+        frameCnt++;
+        if (frameCnt % 120 == 0) {
+            std::cout << "FPS: " << (1000.0 / stats.GetCpu().Mean())
+                      << "  render: " << target.width << "x" << target.height
+                      << "\n";
+            stats.Report(std::cout);
+        }
+    }
+
+    // Only the main thread may end the program, ask it to
+    if (not ok or _glFailed) {
+        *status = EXIT_FAILURE;
+        glfwSetWindowShouldClose(window, GL_TRUE);
+        glfwPostEmptyEvent();
+    }
+    capture.Close();
+    stats.Flush();
+    _reloader.Stop();
+    _textures.Stop();
+    StopTrace();
+    if (opts.audio)
+        StopAudio();
+    glfwMakeContextCurrent(NULL);
+}
+
+int main(int argc, char** argv)
+{
+    Options opts;
+    _ParseArgs(argc, argv, &opts);
+    if (not opts.tracePath.empty()) {
+        StartTrace(opts.tracePath);
+        SetTraceThreadName("main");
+    }
+
+    if (not opts.assetsPath.empty() and _assets.Open(opts.assetsPath)) {
+        std::cout << "Using " << opts.assetsPath << std::endl;
+        _assetsTime = _ModificationTime(opts.assetsPath);
+    }
+    _looseShaders = opts.watch;
+
+    if (opts.bench)
+        exit(_RunBench(opts));
+
+    if (opts.headless)
+        exit(_RunHeadless(opts));
+
     glfwSetErrorCallback(_ErrorCallback);
-    if (!glfwInit())
-        exit(EXIT_FAILURE);
+    {
+        TraceScope scope("glfw init");
+        if (!glfwInit())
+            exit(EXIT_FAILURE);
+    }
     _GLSetCoreProfile();
+    glfwWindowHint(GLFW_DEPTH_BITS, 0);     // see _SetFullscreenPassState
+    glfwWindowHint(GLFW_STENCIL_BITS, 0);
 
     GLFWwindow* window;
     
@@ -332,109 +1711,47 @@ int main(void)
     //int width=1024, height=768;
     //int width=1920, height=800;
 
-    // PI is a nice aspect ratio
-    float aspect = 3.14159265359;
-    float scale = 0.5;
-    int widthFbo=width*scale, 
-        heightFbo=((width*scale)*(1/aspect));
-
     //window = glfwCreateWindow(width, height, "NVScene15", NULL, NULL);
-    window = glfwCreateWindow(width, height, "NVScene15", glfwGetPrimaryMonitor(), NULL);
+    {
+        TraceScope scope("create window");
+        window = glfwCreateWindow(width, height, "NVScene15", glfwGetPrimaryMonitor(), NULL);
+    }
     if (!window) {
         glfwTerminate();
         exit(EXIT_FAILURE);
     }
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
-    glfwMakeContextCurrent(window);
 
-    GLint major=0, minor=0;
-    glGetIntegerv(GL_MAJOR_VERSION, &major);
-    glGetIntegerv(GL_MINOR_VERSION, &minor);
-    _GLCheckError("Check version");
-    std::cout << "OpenGL " << major << "." << minor << std::endl;
-
-    _GLEWInit();
-    _GLInit();
-    _InitFrameTextures(width, height);
-    _InitFBO(widthFbo, heightFbo);
-    _InitRandomTexture();                 // binds TEXTURE0
+    // The reloader compiles on an invisible window's context, which shares
+    // objects with the main one. GLFW only creates windows on this thread.
+    GLFWwindow* reloadWindow = NULL;
+    if (opts.watch) {
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+        reloadWindow = glfwCreateWindow(1, 1, "reload", NULL, window);
+    }
 
     glfwSetKeyCallback(window, _KeyCallback);
-    glfwSwapInterval(0);
-
-    //StartAudio();
-
-    srand(0);
-    
-    double frameTime = 0.0, lastTime = 0.0;
-    size_t frameCnt = 0;
     glfwGetFramebufferSize(window, &width, &height);
-    //std::cout << width << " x " << height << "\n";
 
-    while (!glfwWindowShouldClose(window))
-    {
-        glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, 0);
+    // Windows are created current on this thread, hand the context over
+    glfwMakeContextCurrent(NULL);
+    int status = EXIT_SUCCESS;
+    std::thread renderThread(_RenderThread, std::cref(opts), window,
+                             reloadWindow, width, height, &status);
 
-        glViewport(0, 0, widthFbo, heightFbo);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Nothing else to do here, so sleep until there are events
+    while (not glfwWindowShouldClose(window))
+        glfwWaitEvents();
 
-        glUseProgram(_shaderToy.program);
-        glUniform1f(_shaderToy.iGlobalTimeLoc, glfwGetTime());
-        glUniform1i(_shaderToy.iChannel0Loc, 0);
-        glUniform1i(_shaderToy.iChannel1Loc, 0);
-        glUniform3f(_shaderToy.iResolutionLoc, widthFbo, heightFbo, 1.0);
-        glUniform1f(_shaderToy.iRandomLoc, rand()/float(RAND_MAX));
-        glBindBuffer(GL_ARRAY_BUFFER, _quadBuffer);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(/*attrib*/0, /*vec3*/2, GL_FLOAT, /*normalized*/GL_FALSE, 
-                                /*stride*/0, 0);
-        glDrawArrays(GL_TRIANGLES, 0, 3*2);
-        _GLCheckError("draw");
-        //glDisableVertexAttribArray(0);
-        //glBindBuffer(GL_ARRAY_BUFFER, 0);
-        //glUseProgram(0);
+    // Unlike input, quitting must not be dropped
+    InputEvent quit = { InputEvent::Quit, 0 };
+    while (not _input.Push(quit))
+        std::this_thread::yield();
+    renderThread.join();
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        //glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // Apply film effect and blit to screen
-        glViewport(0, 0, width, height);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(_film.program);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, _texBuffers[0]);
-        glUniform1f(_film.iGlobalTimeLoc, glfwGetTime());
-        glUniform1i(_film.iChannel0Loc, 0);
-        glUniform1i(_film.iChannel1Loc, 1);
-        glUniform3f(_film.iResolutionLoc, widthFbo, heightFbo, 1.0);
-        glUniform1f(_film.iRandomLoc, rand()/float(RAND_MAX));
-        glDrawArrays(GL_TRIANGLES, 0, 3*2);
-        _GLCheckError("draw2");
-
-        #if 0
-        // Blit to screen with no effect.
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
-        _GLCheckError("blitbind");
-        glBlitFramebuffer(0,0,widthFbo,heightFbo,0,height*.25,width,height*.75,GL_COLOR_BUFFER_BIT,GL_LINEAR);
-        _GLCheckError("blit");
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-        #endif
-
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-        frameCnt++;
-        frameTime += glfwGetTime() - lastTime;
-        lastTime = glfwGetTime();
-        if (frameCnt % 30 == 0) {
-            std::cout << "FPS: " << (frameCnt / frameTime) << "\n";
-            frameTime = 0;
-            frameCnt = 0;
-        }
-    }
+    if (reloadWindow)
+        glfwDestroyWindow(reloadWindow);
     glfwDestroyWindow(window);
     glfwTerminate();
-    exit(EXIT_SUCCESS);
+    exit(status);
 }
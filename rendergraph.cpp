@@ -0,0 +1,541 @@
+// Created by Jeremy Cowles, 2015
+
+#include "rendergraph.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+// Frames a pooled texture may sit unused before it is released, e.g. after
+// a resolution change.
+static const size_t _MaxIdleFrames = 120;
+
+static const GLuint _Unknown = ~GLuint(0);
+
+// Unit used for binding textures while allocating them
+static const int _ScratchUnit = RenderGraph::MaxUnits - 1;
+
+static bool
+_IsDepthFormat(GLenum format)
+{
+    return format == GL_DEPTH_COMPONENT16
+        or format == GL_DEPTH_COMPONENT24
+        or format == GL_DEPTH_COMPONENT32F;
+}
+
+static bool
+_SameDesc(RenderGraph::TextureDesc const & a,
+          RenderGraph::TextureDesc const & b)
+{
+    return a.width == b.width and a.height == b.height
+        and a.format == b.format;
+}
+
+// Only a hint, which 4.1 contexts (macOS) can't give.
+static void
+_Invalidate(std::vector<GLenum> const & attachments)
+{
+    if (attachments.empty() or not GLEW_ARB_invalidate_subdata)
+        return;
+    glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, GLsizei(attachments.size()),
+                            &attachments[0]);
+}
+
+static void
+_CheckFramebuffer(char const* name)
+{
+    char const* error = NULL;
+    switch (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER)) {
+    case GL_FRAMEBUFFER_COMPLETE:
+        return;
+    case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:
+        error = "Incomplete attachment";
+        break;
+    case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:
+        error = "missing attachment";
+        break;
+    case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER:
+        error = "incomplete draw buffer";
+        break;
+    case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER:
+        error = "incomplete read buffer";
+        break;
+    case GL_FRAMEBUFFER_UNSUPPORTED:
+        error = "unsupported";
+        break;
+    default:
+        error = "unknown status";
+        break;
+    }
+    std::cerr << "Invalid frame buffer for " << name << ": " << error << "\n";
+    exit(EXIT_FAILURE);
+}
+
+RenderGraph::RenderGraph() :
+    _frame(0)
+{
+    _InvalidateState();
+}
+
+RenderGraph::~RenderGraph()
+{
+    // GL objects are left to the context, which may already be gone.
+}
+
+void
+RenderGraph::Begin()
+{
+    _resources.clear();
+    _passes.clear();
+}
+
+RenderGraph::Resource
+RenderGraph::Create(char const* name, TextureDesc const & desc)
+{
+    _Resource res = { name, _Transient, desc, 0, 1, -1, -1 };
+    _resources.push_back(res);
+    return Resource(_resources.size() - 1);
+}
+
+RenderGraph::Resource
+RenderGraph::Import(char const* name, GLuint texture, GLsizei width,
+                    GLsizei height, int levels)
+{
+    TextureDesc desc = { width, height, GL_NONE };
+    _Resource res = { name, _Imported, desc, texture, levels, -1, -1 };
+    _resources.push_back(res);
+    return Resource(_resources.size() - 1);
+}
+
+RenderGraph::Resource
+RenderGraph::ImportBackbuffer(GLsizei width, GLsizei height)
+{
+    TextureDesc desc = { width, height, GL_NONE };
+    _Resource res = { "backbuffer", _Backbuffer, desc, 0, 1, -1, -1 };
+    _resources.push_back(res);
+    return Resource(_resources.size() - 1);
+}
+
+int
+RenderGraph::AddPass(char const* name, std::function<void()> const & execute)
+{
+    _Pass pass;
+    pass.name = name;
+    pass.execute = execute;
+    pass.live = false;
+    _passes.push_back(pass);
+    return int(_passes.size()) - 1;
+}
+
+void
+RenderGraph::Read(int pass, Resource res, int unit)
+{
+    _Input input = { res, unit, -1 };
+    _passes[pass].reads.push_back(input);
+}
+
+void
+RenderGraph::ReadLevel(int pass, Resource res, int unit, int level)
+{
+    _Input input = { res, unit, level };
+    _passes[pass].reads.push_back(input);
+}
+
+void
+RenderGraph::Write(int pass, Resource res, LoadOp load, int level)
+{
+    _Output output = { res, load, level };
+    _passes[pass].writes.push_back(output);
+}
+
+GLuint
+RenderGraph::GetTexture(Resource res) const
+{
+    return _resources[res].texture;
+}
+
+void
+RenderGraph::_Cull()
+{
+    //
+    // Walk backwards from the outputs that leave the graph: a pass is live
+    // if anything it writes is needed, and then everything it reads is
+    // needed too.
+    //
+    std::vector<bool> needed(_resources.size(), false);
+    for (size_t i = 0; i < _resources.size(); i++)
+        needed[i] = _resources[i].kind != _Transient;
+
+    for (int p = int(_passes.size()) - 1; p >= 0; p--) {
+        _Pass & pass = _passes[p];
+        pass.live = false;
+        for (size_t i = 0; i < pass.writes.size(); i++)
+            pass.live = pass.live or needed[pass.writes[i].res];
+        if (not pass.live)
+            continue;
+        for (size_t i = 0; i < pass.reads.size(); i++)
+            needed[pass.reads[i].res] = true;
+    }
+
+    // Lifetimes over the live passes only
+    for (int p = 0; p < int(_passes.size()); p++) {
+        _Pass const & pass = _passes[p];
+        if (not pass.live)
+            continue;
+        std::vector<Resource> used;
+        for (size_t i = 0; i < pass.reads.size(); i++)
+            used.push_back(pass.reads[i].res);
+        for (size_t i = 0; i < pass.writes.size(); i++)
+            used.push_back(pass.writes[i].res);
+        for (size_t i = 0; i < used.size(); i++) {
+            _Resource & res = _resources[used[i]];
+            if (res.firstPass < 0)
+                res.firstPass = p;
+            res.lastPass = p;
+        }
+    }
+}
+
+void
+RenderGraph::_Acquire(_Resource* res)
+{
+    for (size_t i = 0; i < _pool.size(); i++) {
+        _Pooled & pooled = _pool[i];
+        if (not pooled.inUse and _SameDesc(pooled.desc, res->desc)) {
+            pooled.inUse = true;
+            pooled.lastUsed = _frame;
+            res->texture = pooled.texture;
+            return;
+        }
+    }
+
+    TextureDesc const & desc = res->desc;
+    bool depth = _IsDepthFormat(desc.format);
+    GLuint tex = 0;
+    glGenTextures(1, &tex);
+    _BindTexture(_ScratchUnit, tex);
+    GLint filter = depth ? GL_NEAREST : GL_LINEAR;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    if (GLEW_ARB_texture_storage) {
+        glTexStorage2D(GL_TEXTURE_2D, 1, desc.format, desc.width, desc.height);
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height,
+                     0, depth ? GL_DEPTH_COMPONENT : GL_RGBA, GL_FLOAT, NULL);
+    }
+
+    _Pooled pooled = { desc, tex, true, _frame };
+    _pool.push_back(pooled);
+    res->texture = tex;
+}
+
+void
+RenderGraph::_Release(_Resource* res)
+{
+    for (size_t i = 0; i < _pool.size(); i++) {
+        if (_pool[i].texture == res->texture)
+            _pool[i].inUse = false;
+    }
+}
+
+void
+RenderGraph::_ReleaseIdle()
+{
+    for (size_t i = 0; i < _pool.size(); ) {
+        _Pooled & pooled = _pool[i];
+        if (pooled.inUse or pooled.lastUsed + _MaxIdleFrames > _frame) {
+            i++;
+            continue;
+        }
+
+        // Framebuffers using it are no good any more either
+        std::map<std::vector<GLuint>, GLuint>::iterator it = _fbos.begin();
+        while (it != _fbos.end()) {
+            std::vector<GLuint> const & key = it->first;
+            if (std::find(key.begin(), key.end(), pooled.texture)
+                != key.end())
+            {
+                if (_boundFbo == it->second)
+                    _boundFbo = _Unknown;
+                glDeleteFramebuffers(1, &it->second);
+                _fbos.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        for (int u = 0; u < MaxUnits; u++) {
+            if (_units[u] == pooled.texture)
+                _units[u] = _Unknown;
+        }
+        glDeleteTextures(1, &pooled.texture);
+        _pool.erase(_pool.begin() + i);
+    }
+}
+
+GLuint
+RenderGraph::_GetFramebuffer(_Pass const & pass)
+{
+    // Texture and level of every attachment
+    std::vector<GLuint> key;
+    for (size_t i = 0; i < pass.writes.size(); i++) {
+        _Resource const & res = _resources[pass.writes[i].res];
+        if (res.kind == _Backbuffer)
+            return 0;
+        key.push_back(res.texture);
+        key.push_back(GLuint(pass.writes[i].level));
+    }
+
+    std::map<std::vector<GLuint>, GLuint>::iterator it = _fbos.find(key);
+    if (it != _fbos.end())
+        return it->second;
+
+    GLuint fbo = 0;
+    glGenFramebuffers(1, &fbo);
+    _BindFramebuffer(fbo);
+    std::vector<GLenum> drawBuffers;
+    for (size_t i = 0; i < pass.writes.size(); i++) {
+        _Resource const & res = _resources[pass.writes[i].res];
+        GLenum attachment = GL_DEPTH_ATTACHMENT;
+        if (not _IsDepthFormat(res.desc.format)) {
+            attachment = GL_COLOR_ATTACHMENT0 + GLenum(drawBuffers.size());
+            drawBuffers.push_back(attachment);
+        }
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, attachment, GL_TEXTURE_2D,
+                               res.texture, pass.writes[i].level);
+    }
+    glDrawBuffers(GLsizei(drawBuffers.size()),
+                  drawBuffers.empty() ? NULL : &drawBuffers[0]);
+    _CheckFramebuffer(pass.name);
+
+    _fbos[key] = fbo;
+    return fbo;
+}
+
+void
+RenderGraph::_GetAttachmentPoints(_Pass const & pass,
+                                  std::vector<GLenum>* points) const
+{
+    GLenum color = GL_COLOR_ATTACHMENT0;
+    for (size_t i = 0; i < pass.writes.size(); i++) {
+        _Resource const & res = _resources[pass.writes[i].res];
+        if (res.kind == _Backbuffer)
+            points->push_back(GL_COLOR);
+        else if (_IsDepthFormat(res.desc.format))
+            points->push_back(GL_DEPTH_ATTACHMENT);
+        else
+            points->push_back(color++);
+    }
+}
+
+void
+RenderGraph::_BeginPass(_Pass const & pass)
+{
+    // Nothing may sample what this pass renders to
+    for (size_t i = 0; i < pass.writes.size(); i++) {
+        GLuint tex = _resources[pass.writes[i].res].texture;
+        for (int u = 0; tex and u < MaxUnits; u++) {
+            if (_units[u] == tex or _units[u] == _Unknown)
+                _BindTexture(u, 0);
+        }
+    }
+    for (size_t i = 0; i < pass.reads.size(); i++) {
+        _Input const & input = pass.reads[i];
+        _BindTexture(input.unit, _resources[input.res].texture);
+        if (input.level >= 0)
+            _SetLevels(input, input.level, input.level);
+    }
+
+    if (pass.writes.empty())
+        return;
+
+    _BindFramebuffer(_GetFramebuffer(pass));
+
+    TextureDesc const & desc = _resources[pass.writes[0].res].desc;
+    int level = pass.writes[0].level;
+    GLsizei width = std::max(desc.width >> level, 1);
+    GLsizei height = std::max(desc.height >> level, 1);
+    if (_viewport[0] != 0 or _viewport[1] != 0
+        or _viewport[2] != width or _viewport[3] != height)
+    {
+        glViewport(0, 0, width, height);
+        _viewport[0] = _viewport[1] = 0;
+        _viewport[2] = width;
+        _viewport[3] = height;
+    }
+
+    std::vector<GLenum> points;
+    _GetAttachmentPoints(pass, &points);
+    std::vector<GLenum> dead;
+    for (size_t i = 0; i < pass.writes.size(); i++) {
+        if (pass.writes[i].load == DontCare)
+            dead.push_back(points[i]);
+    }
+    _Invalidate(dead);
+
+    //
+    // One glClear when every color target clears, which is the common case;
+    // otherwise clear the attachments one by one.
+    //
+    GLbitfield bits = 0;
+    bool partialColor = false;
+    int colorIndex = 0;
+    for (size_t i = 0; i < pass.writes.size(); i++) {
+        _Resource const & res = _resources[pass.writes[i].res];
+        bool clear = pass.writes[i].load == Clear;
+        if (res.kind == _Backbuffer) {
+            bits |= clear ? GL_COLOR_BUFFER_BIT : 0;
+        } else if (_IsDepthFormat(res.desc.format)) {
+            bits |= clear ? GL_DEPTH_BUFFER_BIT : 0;
+        } else {
+            bits |= clear ? GL_COLOR_BUFFER_BIT : 0;
+            partialColor = partialColor or not clear;
+            colorIndex++;
+        }
+    }
+    if ((bits & GL_COLOR_BUFFER_BIT) and partialColor) {
+        GLfloat color[4];
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, color);
+        colorIndex = 0;
+        for (size_t i = 0; i < pass.writes.size(); i++) {
+            _Resource const & res = _resources[pass.writes[i].res];
+            if (_IsDepthFormat(res.desc.format))
+                continue;
+            if (pass.writes[i].load == Clear)
+                glClearBufferfv(GL_COLOR, colorIndex, color);
+            colorIndex++;
+        }
+        bits &= ~GL_COLOR_BUFFER_BIT;
+    }
+    if (bits)
+        glClear(bits);
+}
+
+void
+RenderGraph::_EndPass(_Pass const & pass)
+{
+    // Every level visible again
+    for (size_t i = 0; i < pass.reads.size(); i++) {
+        _Input const & input = pass.reads[i];
+        if (input.level >= 0)
+            _SetLevels(input, 0, _resources[input.res].levels - 1);
+    }
+}
+
+//
+// Restricting the levels a texture can be sampled from is what makes
+// rendering to one level while reading another well defined; otherwise it
+// is a feedback loop even if the shader never touches the target level.
+//
+void
+RenderGraph::_SetLevels(_Input const & input, int base, int max)
+{
+    _BindTexture(input.unit, _resources[input.res].texture);
+    _SetActiveUnit(input.unit);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max);
+}
+
+void
+RenderGraph::Execute()
+{
+    _Cull();
+
+    for (int p = 0; p < int(_passes.size()); p++) {
+        _Pass const & pass = _passes[p];
+        if (not pass.live)
+            continue;
+
+        for (size_t i = 0; i < _resources.size(); i++) {
+            _Resource & res = _resources[i];
+            if (res.kind == _Transient and res.firstPass == p)
+                _Acquire(&res);
+        }
+
+        {
+            TraceScope cpuScope(pass.name);
+            TraceGpuScope gpuScope(pass.name);
+            _BeginPass(pass);
+            pass.execute();
+            _EndPass(pass);
+        }
+
+        // Targets that die here needn't be written back
+        std::vector<GLenum> points, dead;
+        _GetAttachmentPoints(pass, &points);
+        for (size_t i = 0; i < pass.writes.size(); i++) {
+            _Resource const & res = _resources[pass.writes[i].res];
+            if (res.kind == _Transient and res.lastPass == p)
+                dead.push_back(points[i]);
+        }
+        _Invalidate(dead);
+
+        // Free for aliasing by later passes
+        for (size_t i = 0; i < _resources.size(); i++) {
+            _Resource & res = _resources[i];
+            if (res.kind == _Transient and res.lastPass == p)
+                _Release(&res);
+        }
+    }
+
+    _frame++;
+    _ReleaseIdle();
+}
+
+void
+RenderGraph::Trim()
+{
+    for (std::map<std::vector<GLuint>, GLuint>::iterator it = _fbos.begin();
+         it != _fbos.end(); ++it)
+    {
+        glDeleteFramebuffers(1, &it->second);
+    }
+    _fbos.clear();
+    for (size_t i = 0; i < _pool.size(); i++)
+        glDeleteTextures(1, &_pool[i].texture);
+    _pool.clear();
+    _InvalidateState();
+}
+
+void
+RenderGraph::_BindFramebuffer(GLuint fbo)
+{
+    if (_boundFbo == fbo)
+        return;
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+    _boundFbo = fbo;
+}
+
+void
+RenderGraph::_BindTexture(int unit, GLuint texture)
+{
+    if (_units[unit] == texture)
+        return;
+    _SetActiveUnit(unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    _units[unit] = texture;
+}
+
+void
+RenderGraph::_SetActiveUnit(int unit)
+{
+    if (_activeUnit == unit)
+        return;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    _activeUnit = unit;
+}
+
+void
+RenderGraph::_InvalidateState()
+{
+    _boundFbo = _Unknown;
+    for (int i = 0; i < 4; i++)
+        _viewport[i] = -1;
+    for (int i = 0; i < MaxUnits; i++)
+        _units[i] = _Unknown;
+    _activeUnit = -1;
+}
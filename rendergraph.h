@@ -0,0 +1,166 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <vector>
+
+//
+// A small render graph: the frame is declared as a list of passes, each
+// naming the textures it samples and the targets it renders to, and the
+// graph takes care of the GL objects and state in between.
+//
+// The graph is rebuilt every frame (Begin, declare, Execute) but the GL
+// objects behind it persist:
+//
+//  - Transient textures (Create) only live for the frame. They are taken
+//    from a pool when first used and returned after their last use, so a
+//    later pass asking for the same size and format reuses (aliases) the
+//    same texture. Pooled textures unused for a while are released.
+//  - Imported textures and the backbuffer are owned by the caller, e.g.
+//    history that must survive into the next frame. Imported textures may
+//    have mipmaps, whose levels can be rendered to one at a time.
+//  - Framebuffers are cached per attachment set.
+//  - Framebuffer, viewport and texture unit bindings are tracked, so
+//    passes never pay for rebinding what is already bound.
+//
+// Passes whose outputs are never used (no later pass reads them and they
+// aren't imported) are culled, and transient targets are invalidated after
+// their last pass so their contents are never written back. Before a pass
+// runs, any texture unit still holding one of its render targets is
+// unbound, which is the only hazard plain render-to-texture has in GL.
+//
+class RenderGraph
+{
+public:
+    typedef int Resource;
+
+    //
+    // What happens to a target's contents when a pass starts rendering to
+    // it. DontCare is for passes that overwrite everything that is read
+    // later; the old contents are invalidated rather than cleared, which
+    // saves a tiler from loading them (and everyone from a clear).
+    //
+    enum LoadOp { Load, Clear, DontCare };
+
+    struct TextureDesc {
+        GLsizei width;
+        GLsizei height;
+        GLenum format;          // sized internal format, depth allowed
+    };
+
+    static const int MaxUnits = 8;
+
+    RenderGraph();
+    ~RenderGraph();
+
+    // Starts declaring a new frame.
+    void Begin();
+
+    Resource Create(char const* name, TextureDesc const & desc);
+    Resource Import(char const* name, GLuint texture, GLsizei width,
+                    GLsizei height, int levels = 1);
+    Resource ImportBackbuffer(GLsizei width, GLsizei height);
+
+    // Passes run in the order they are added.
+    int AddPass(char const* name, std::function<void()> const & execute);
+
+    // Binds the resource to the given texture unit while the pass runs.
+    void Read(int pass, Resource res, int unit);
+
+    //
+    // Like Read, but only the given mip level is visible to the pass (as
+    // level 0), so the pass may render to another level of the same
+    // texture, e.g. to build a mip chain.
+    //
+    void ReadLevel(int pass, Resource res, int unit, int level);
+
+    // Renders to the resource (at the given mip level), colors in
+    // attachment order. Clears use the current GL clear color (and depth 1);
+    // the backbuffer is assumed to be color only.
+    void Write(int pass, Resource res, LoadOp load, int level = 0);
+
+    // Culls, allocates and runs the passes.
+    void Execute();
+
+    // Only valid while the graph is executing.
+    GLuint GetTexture(Resource res) const;
+
+    //
+    // Releases every pooled texture and framebuffer and forgets the tracked
+    // state; call after deleting imported textures or binding GL state
+    // behind the graph's back.
+    //
+    void Trim();
+
+private:
+    enum _Kind { _Transient, _Imported, _Backbuffer };
+
+    struct _Resource {
+        char const* name;
+        _Kind kind;
+        TextureDesc desc;
+        GLuint texture;
+        int levels;
+        int firstPass;
+        int lastPass;
+    };
+
+    struct _Input {
+        Resource res;
+        int unit;
+        int level;              // -1 for all of them
+    };
+
+    struct _Output {
+        Resource res;
+        LoadOp load;
+        int level;
+    };
+
+    struct _Pass {
+        char const* name;
+        std::function<void()> execute;
+        std::vector<_Input> reads;
+        std::vector<_Output> writes;
+        bool live;
+    };
+
+    struct _Pooled {
+        TextureDesc desc;
+        GLuint texture;
+        bool inUse;
+        size_t lastUsed;
+    };
+
+    void _Cull();
+    void _Acquire(_Resource* res);
+    void _Release(_Resource* res);
+    void _ReleaseIdle();
+    GLuint _GetFramebuffer(_Pass const & pass);
+    void _GetAttachmentPoints(_Pass const & pass,
+                              std::vector<GLenum>* points) const;
+    void _BeginPass(_Pass const & pass);
+    void _EndPass(_Pass const & pass);
+    void _SetLevels(_Input const & input, int base, int max);
+    void _BindFramebuffer(GLuint fbo);
+    void _BindTexture(int unit, GLuint texture);
+    void _SetActiveUnit(int unit);
+    void _InvalidateState();
+
+    std::vector<_Resource> _resources;
+    std::vector<_Pass> _passes;
+    std::vector<_Pooled> _pool;
+    std::map<std::vector<GLuint>, GLuint> _fbos;
+    size_t _frame;
+
+    // Tracked GL state, ~0 when unknown
+    GLuint _boundFbo;
+    GLint _viewport[4];
+    GLuint _units[MaxUnits];
+    int _activeUnit;
+};
@@ -0,0 +1,164 @@
+// Created by Jeremy Cowles, 2015
+
+#include "shadercache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static std::string _cacheDir = ".shadercache";
+
+// Bump when the file layout changes
+static const char _magic[4] = { 'D', 'P', 'B', '1' };
+
+void
+SetShaderCacheDir(std::string const & dir)
+{
+    _cacheDir = dir;
+}
+
+bool
+IsShaderCacheEnabled()
+{
+    if (_cacheDir.empty())
+        return false;
+
+    // Drivers are allowed to support the extension with zero formats.
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    return numFormats > 0;
+}
+
+// 64-bit FNV-1a, good enough to key a handful of files.
+static unsigned long long
+_Hash(unsigned long long h, char const* str)
+{
+    if (not str)
+        return h;
+    for (; *str; str++) {
+        h ^= (unsigned char)*str;
+        h *= 1099511628211ULL;
+    }
+    // Terminate each field so "ab"+"c" and "a"+"bc" differ.
+    h ^= 0xff;
+    h *= 1099511628211ULL;
+    return h;
+}
+
+std::string
+ShaderCacheKey(char const* vsSrc, char const* fsSrc)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    h = _Hash(h, vsSrc);
+    h = _Hash(h, fsSrc);
+    h = _Hash(h, (char const*)glGetString(GL_VENDOR));
+    h = _Hash(h, (char const*)glGetString(GL_RENDERER));
+    h = _Hash(h, (char const*)glGetString(GL_VERSION));
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", h);
+    return key;
+}
+
+static std::string
+_PathForKey(std::string const & key)
+{
+    return _cacheDir + "/" + key + ".bin";
+}
+
+GLuint
+LoadCachedProgram(std::string const & key)
+{
+    if (not IsShaderCacheEnabled())
+        return 0;
+
+    std::string path = _PathForKey(key);
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (not file.is_open())
+        return 0;
+
+    char magic[4];
+    GLenum format = 0;
+    unsigned length = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char*)&format, sizeof(format));
+    file.read((char*)&length, sizeof(length));
+
+    // The length is only trusted once it fits in what is left of the file
+    std::streamoff header = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff remaining = file.tellg() - header;
+    file.seekg(header);
+    bool valid = file and memcmp(magic, _magic, sizeof(magic)) == 0
+        and length and std::streamoff(length) <= remaining;
+    std::vector<char> binary;
+    if (valid) {
+        binary.resize(length);
+        file.read(&binary[0], length);
+        valid = bool(file);
+    }
+    if (not valid) {
+        std::cerr << "Ignoring corrupt shader cache entry " << path << "\n";
+        remove(path.c_str());
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, &binary[0], length);
+
+    // A driver that no longer accepts the binary fails the link (or raises
+    // INVALID_ENUM for an unknown format), neither is fatal here.
+    while (glGetError() != GL_NO_ERROR)
+        ;
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE) {
+        glDeleteProgram(program);
+        remove(path.c_str());
+        return 0;
+    }
+    return program;
+}
+
+void
+StoreCachedProgram(std::string const & key, GLuint program)
+{
+    if (not IsShaderCacheEnabled())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, &binary[0]);
+    if (glGetError() != GL_NO_ERROR)
+        return;
+
+    mkdir(_cacheDir.c_str(), 0755);
+
+    // Write to a temporary and rename, so a concurrent or interrupted run
+    // never sees a partial entry.
+    std::string path = _PathForKey(key);
+    std::string tmpPath = path + ".tmp";
+    std::ofstream file(tmpPath.c_str(), std::ios::binary);
+    if (not file.is_open()) {
+        std::cerr << "Failed to write shader cache entry " << path << "\n";
+        return;
+    }
+    unsigned size = length;
+    file.write(_magic, sizeof(_magic));
+    file.write((char const*)&format, sizeof(format));
+    file.write((char const*)&size, sizeof(size));
+    file.write(&binary[0], length);
+    file.close();
+    if (not file or rename(tmpPath.c_str(), path.c_str()) != 0)
+        remove(tmpPath.c_str());
+}
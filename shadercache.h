@@ -0,0 +1,33 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+
+//
+// Persistent cache of linked program binaries (ARB_get_program_binary).
+//
+// Entries are keyed by a hash of the shader sources together with the GL
+// vendor, renderer and version strings, so a driver update or a shader edit
+// simply misses. Programs that should be cached must be linked with
+// GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+//
+
+// Sets the cache directory, an empty path disables the cache.
+void SetShaderCacheDir(std::string const & dir);
+bool IsShaderCacheEnabled();
+
+// Builds the cache key for a program, requires a current GL context.
+std::string ShaderCacheKey(char const* vsSrc, char const* fsSrc);
+
+//
+// Returns a linked program for the key, or 0 if there is no entry or the
+// driver rejected it (in which case the stale entry is removed and the
+// caller should compile from source).
+//
+GLuint LoadCachedProgram(std::string const & key);
+
+// Writes the binary of a successfully linked program to the cache.
+void StoreCachedProgram(std::string const & key, GLuint program);
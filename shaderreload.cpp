@@ -0,0 +1,275 @@
+// Created by Jeremy Cowles, 2015
+
+#include "shaderreload.h"
+#include "shadercache.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#if __linux__
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+// How long to wait for an editor to finish writing before rebuilding; saves
+// often show up as several events in quick succession.
+static const int _DebounceMs = 50;
+static const int _PollMs = 100;
+
+static std::string
+_ReadSource(std::string const & path)
+{
+    std::ifstream file(path.c_str());
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+static long long
+_ModificationTime(std::string const & path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return 0;
+    return (long long)st.st_mtime;
+}
+
+static GLuint
+_CompileShader(GLenum shaderType, std::string const & source,
+               std::string const & path)
+{
+    GLuint shader = glCreateShader(shaderType);
+    char const* src = source.c_str();
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status == GL_FALSE) {
+        char log[4096];
+        GLsizei length = 0;
+        glGetShaderInfoLog(shader, sizeof(log), &length, log);
+        std::cerr << "Reload: failed to compile " << path << "\n" << log
+                  << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+ShaderReloader::ShaderReloader() :
+    _running(false),
+    _notifyFd(-1)
+{
+}
+
+ShaderReloader::~ShaderReloader()
+{
+    Stop();
+}
+
+int
+ShaderReloader::Watch(std::string const & vsPath, std::string const & fsPath)
+{
+    _Slot slot = { vsPath, fsPath, 0 };
+    _slots.push_back(slot);
+    return int(_slots.size()) - 1;
+}
+
+void
+ShaderReloader::Start(ContextFn makeCurrent, ContextFn release)
+{
+    if (_running)
+        return;
+
+    _makeCurrent = makeCurrent;
+    _release = release;
+
+#if __linux__
+    //
+    // Watch the directory rather than the files: most editors save by
+    // writing a new file and renaming it over the old one, which would
+    // silently end a watch on the original inode.
+    //
+    _notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_notifyFd >= 0
+        and inotify_add_watch(_notifyFd, ".",
+                              IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)
+    {
+        close(_notifyFd);
+        _notifyFd = -1;
+    }
+#endif
+    if (_notifyFd < 0) {
+        _mtimes.clear();
+        for (size_t i = 0; i < _slots.size(); i++) {
+            _mtimes.push_back(_ModificationTime(_slots[i].vsPath));
+            _mtimes.push_back(_ModificationTime(_slots[i].fsPath));
+        }
+    }
+
+    _running = true;
+    _thread = std::thread(&ShaderReloader::_Run, this);
+    std::cout << "Watching shaders for changes\n";
+}
+
+void
+ShaderReloader::Stop()
+{
+    if (not _running)
+        return;
+    _running = false;
+    _thread.join();
+
+#if __linux__
+    if (_notifyFd >= 0)
+        close(_notifyFd);
+    _notifyFd = -1;
+#endif
+
+    // Programs that were never picked up
+    for (size_t i = 0; i < _slots.size(); i++) {
+        if (_slots[i].ready)
+            glDeleteProgram(_slots[i].ready);
+        _slots[i].ready = 0;
+    }
+}
+
+bool
+ShaderReloader::TakeProgram(int slot, GLuint* program)
+{
+    // Never wait on the worker, the next frame will try again.
+    std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+    if (not lock.owns_lock() or not _slots[slot].ready)
+        return false;
+    *program = _slots[slot].ready;
+    _slots[slot].ready = 0;
+    return true;
+}
+
+void
+ShaderReloader::_Run()
+{
+    _makeCurrent();
+
+    std::vector<bool> dirty(_slots.size(), false);
+    while (_running) {
+        if (not _WaitForChanges(&dirty))
+            continue;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(_DebounceMs));
+        _WaitForChanges(&dirty);
+
+        for (size_t i = 0; i < dirty.size(); i++) {
+            if (dirty[i])
+                _Rebuild(int(i));
+            dirty[i] = false;
+        }
+    }
+
+    _release();
+}
+
+bool
+ShaderReloader::_WaitForChanges(std::vector<bool>* dirty)
+{
+    bool changed = false;
+
+#if __linux__
+    if (_notifyFd >= 0) {
+        struct pollfd pfd = { _notifyFd, POLLIN, 0 };
+        if (poll(&pfd, 1, _PollMs) <= 0)
+            return false;
+
+        char buf[4096]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t len;
+        while ((len = read(_notifyFd, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + len; ) {
+                struct inotify_event* ev = (struct inotify_event*)p;
+                p += sizeof(struct inotify_event) + ev->len;
+                if (not ev->len)
+                    continue;
+                std::string name = ev->name;
+                for (size_t i = 0; i < _slots.size(); i++) {
+                    if (name == _slots[i].vsPath or name == _slots[i].fsPath) {
+                        (*dirty)[i] = true;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        return changed;
+    }
+#endif
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(_PollMs));
+    for (size_t i = 0; i < _slots.size(); i++) {
+        long long vs = _ModificationTime(_slots[i].vsPath);
+        long long fs = _ModificationTime(_slots[i].fsPath);
+        if (vs != _mtimes[2*i] or fs != _mtimes[2*i + 1]) {
+            _mtimes[2*i] = vs;
+            _mtimes[2*i + 1] = fs;
+            (*dirty)[i] = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void
+ShaderReloader::_Rebuild(int slot)
+{
+    std::string vsPath = _slots[slot].vsPath;
+    std::string fsPath = _slots[slot].fsPath;
+    std::string vsSrc = _ReadSource(vsPath);
+    std::string fsSrc = _ReadSource(fsPath);
+
+    // Compiling here blocks this thread only, that's the point.
+    GLuint vs = _CompileShader(GL_VERTEX_SHADER, vsSrc, vsPath);
+    GLuint fs = _CompileShader(GL_FRAGMENT_SHADER, fsSrc, fsPath);
+    if (not vs or not fs) {
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        return;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    glDetachShader(program, vs);
+    glDetachShader(program, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE) {
+        char log[4096];
+        GLsizei length = 0;
+        glGetProgramInfoLog(program, sizeof(log), &length, log);
+        std::cerr << "Reload: failed to link " << vsPath << " + " << fsPath
+                  << "\n" << log << std::endl;
+        glDeleteProgram(program);
+        return;
+    }
+
+    StoreCachedProgram(ShaderCacheKey(vsSrc.c_str(), fsSrc.c_str()), program);
+
+    // The render context may only use the program once this context is done
+    // with it.
+    glFinish();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_slots[slot].ready)
+        glDeleteProgram(_slots[slot].ready);
+    _slots[slot].ready = program;
+    std::cout << "Reloaded " << vsPath << " + " << fsPath << std::endl;
+}
@@ -0,0 +1,72 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Watches GLSL files and relinks programs on a worker thread when they
+// change, so shaders can be iterated on without restarting the demo.
+//
+// The worker owns a GL context shared with the render context, provided by
+// the caller. A program is only handed over once it has linked successfully
+// and the worker has finished with it; on failure the log is printed and the
+// live program keeps running. The render thread picks new programs up with
+// TakeProgram, which never blocks.
+//
+class ShaderReloader
+{
+public:
+    typedef std::function<void()> ContextFn;
+
+    ShaderReloader();
+    ~ShaderReloader();
+
+    // Registers a program built from the given vertex and fragment shader
+    // files (relative to the working directory). Returns its slot.
+    int Watch(std::string const & vsPath, std::string const & fsPath);
+
+    //
+    // Starts the worker. makeCurrent is called on the worker thread before
+    // any GL work and must bind a context shared with the render context;
+    // release is called on the worker thread before it exits.
+    //
+    void Start(ContextFn makeCurrent, ContextFn release);
+    void Stop();
+
+    //
+    // If a newly linked program is ready for the slot, returns true and
+    // transfers ownership of it to the caller, who is responsible for
+    // deleting the program it replaces.
+    //
+    bool TakeProgram(int slot, GLuint* program);
+
+private:
+    struct _Slot {
+        std::string vsPath;
+        std::string fsPath;
+        GLuint ready;
+    };
+
+    void _Run();
+    bool _WaitForChanges(std::vector<bool>* dirty);
+    void _Rebuild(int slot);
+
+    std::vector<_Slot> _slots;
+    std::mutex _mutex;
+    std::thread _thread;
+    std::atomic<bool> _running;
+    ContextFn _makeCurrent;
+    ContextFn _release;
+
+    // inotify descriptor, or -1 when polling modification times
+    int _notifyFd;
+    std::vector<long long> _mtimes;
+};
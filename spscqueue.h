@@ -0,0 +1,72 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+//
+// A bounded, lock-free queue between exactly one producer thread and one
+// consumer thread.
+//
+// Each side only ever writes its own index: the producer publishes an item
+// by advancing the tail with release semantics after filling the slot, the
+// consumer frees the slot by advancing the head once it has copied the
+// item out. Neither side ever blocks or takes a lock, so e.g. an event
+// callback can't be held up by a frame in progress.
+//
+// Indices count up forever and are wrapped on use, which keeps full and
+// empty distinguishable without wasting a slot.
+//
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+public:
+    SpscQueue();
+
+    // Producer only; false (and nothing queued) when full.
+    bool Push(T const & item);
+
+    // Consumer only; false when empty.
+    bool Pop(T* item);
+
+private:
+    static_assert(Capacity > 0 and (Capacity & (Capacity - 1)) == 0,
+                  "SpscQueue capacity must be a power of two");
+
+    // Apart, so the two threads don't fight over one cache line
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+    T _items[Capacity];
+};
+
+template <typename T, size_t Capacity>
+SpscQueue<T, Capacity>::SpscQueue() :
+    _head(0),
+    _tail(0)
+{
+}
+
+template <typename T, size_t Capacity>
+bool
+SpscQueue<T, Capacity>::Push(T const & item)
+{
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == Capacity)
+        return false;
+    _items[tail & (Capacity - 1)] = item;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T, size_t Capacity>
+bool
+SpscQueue<T, Capacity>::Pop(T* item)
+{
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire))
+        return false;
+    *item = _items[head & (Capacity - 1)];
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+}
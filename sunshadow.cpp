@@ -0,0 +1,146 @@
+// Created by Jeremy Cowles, 2015
+
+#include "sunshadow.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Splits [lo, hi) into the spans it covers in a texture wrapping around
+// every size texels, returns how many (1 or 2).
+static int
+_Wrap(int lo, int hi, int size, int spans[2][2])
+{
+    int start = lo & (size - 1);
+    int end = start + (hi - lo);
+    spans[0][0] = start;
+    spans[0][1] = std::min(end, size);
+    if (end <= size)
+        return 1;
+    spans[1][0] = 0;
+    spans[1][1] = end - size;
+    return 2;
+}
+
+SunShadow::SunShadow() :
+    _texture(0),
+    _size(0),
+    _texelSize(0),
+    _valid(false)
+{
+    _baked.x0 = _baked.z0 = _baked.x1 = _baked.z1 = 0;
+}
+
+void
+SunShadow::Init(int size, float texelSize)
+{
+    _size = size;
+    _texelSize = texelSize;
+    _valid = false;
+
+    // Filtered across the wrap like anywhere else
+    glGenTextures(1, &_texture);
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    if (GLEW_ARB_texture_storage) {
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16F, size, size);
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, size, size, 0, GL_RED,
+                     GL_FLOAT, NULL);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void
+SunShadow::Update(float originX, float originZ, float focusX, float focusZ,
+                  int budget, std::vector<Rect>* bakes)
+{
+    bakes->clear();
+
+    // The tile's corner is a whole number of texels
+    Rect tile;
+    tile.x0 = int(std::floor(originX / _texelSize + 0.5f));
+    tile.z0 = int(std::floor(originZ / _texelSize + 0.5f));
+    tile.x1 = tile.x0 + _size;
+    tile.z1 = tile.z0 + _size;
+
+    Rect baked = _baked;
+    baked.x0 = std::max(baked.x0, tile.x0);
+    baked.z0 = std::max(baked.z0, tile.z0);
+    baked.x1 = std::min(baked.x1, tile.x1);
+    baked.z1 = std::min(baked.z1, tile.z1);
+
+    // Start over with a square around the camera
+    if (not _valid or baked.x0 >= baked.x1 or baked.z0 >= baked.z1) {
+        int side = std::max(std::min(_size, int(std::sqrt(float(budget)))), 1);
+        int fx = int(std::floor(focusX / _texelSize)) - side / 2;
+        int fz = int(std::floor(focusZ / _texelSize)) - side / 2;
+        baked.x0 = std::min(std::max(fx, tile.x0), tile.x1 - side);
+        baked.z0 = std::min(std::max(fz, tile.z0), tile.z1 - side);
+        baked.x1 = baked.x0 + side;
+        baked.z1 = baked.z0 + side;
+        _Bake(baked, bakes);
+        budget -= side * side;
+        _valid = true;
+    }
+
+    //
+    // Grow every side that hasn't reached the tile's edge by an even share
+    // of what is left. The x sides go first, so the z sides' strips span
+    // the corners and the baked texels stay a rectangle.
+    //
+    int open = (baked.x0 > tile.x0) + (baked.x1 < tile.x1)
+             + (baked.z0 > tile.z0) + (baked.z1 < tile.z1);
+    int share = open > 0 ? budget / open : 0;
+    if (share > 0) {
+        int rows = std::max(share / (baked.z1 - baked.z0), 1);
+        if (baked.x0 > tile.x0) {
+            Rect strip = baked;
+            strip.x0 = std::max(baked.x0 - rows, tile.x0);
+            strip.x1 = baked.x0;
+            _Bake(strip, bakes);
+            baked.x0 = strip.x0;
+        }
+        if (baked.x1 < tile.x1) {
+            Rect strip = baked;
+            strip.x0 = baked.x1;
+            strip.x1 = std::min(baked.x1 + rows, tile.x1);
+            _Bake(strip, bakes);
+            baked.x1 = strip.x1;
+        }
+
+        rows = std::max(share / (baked.x1 - baked.x0), 1);
+        if (baked.z0 > tile.z0) {
+            Rect strip = baked;
+            strip.z0 = std::max(baked.z0 - rows, tile.z0);
+            strip.z1 = baked.z0;
+            _Bake(strip, bakes);
+            baked.z0 = strip.z0;
+        }
+        if (baked.z1 < tile.z1) {
+            Rect strip = baked;
+            strip.z0 = baked.z1;
+            strip.z1 = std::min(baked.z1 + rows, tile.z1);
+            _Bake(strip, bakes);
+            baked.z1 = strip.z1;
+        }
+    }
+    _baked = baked;
+}
+
+void
+SunShadow::_Bake(Rect const & world, std::vector<Rect>* bakes) const
+{
+    int xs[2][2], zs[2][2];
+    int nx = _Wrap(world.x0, world.x1, _size, xs);
+    int nz = _Wrap(world.z0, world.z1, _size, zs);
+    for (int i = 0; i < nx; i++) {
+        for (int j = 0; j < nz; j++) {
+            Rect rect = { xs[i][0], zs[j][0], xs[i][1], zs[j][1] };
+            bakes->push_back(rect);
+        }
+    }
+}
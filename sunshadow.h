@@ -0,0 +1,68 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <vector>
+
+//
+// The sun's soft shadow on the terrain, baked over the heightfield's tile:
+// the sun never moves, so each texel holds what softShadow returns for the
+// terrain surface at its center, and shading a hit on the sand is a
+// filtered lookup instead of a march towards the sun.
+//
+// Baking is incremental. The texture wraps around (world texel W is stored
+// at W mod size), so when the tile moves everything still inside it stays
+// put and is kept. The baked texels form one rectangle, which starts around
+// the camera and grows towards the tile's edges by a bounded number of
+// texels per frame; hits outside of it march as before.
+//
+class SunShadow
+{
+public:
+    // Texels, half open: [x0, x1) x [z0, z1).
+    struct Rect {
+        int x0, z0, x1, z1;
+    };
+
+    SunShadow();
+
+    //
+    // Allocates the R16F texture, size texels across (a power of two) of
+    // texelSize world units each, as for the heightfield it follows.
+    // Requires a current GL context.
+    //
+    void Init(int size, float texelSize);
+
+    //
+    // Follows the heightfield tile whose corner is at the given world xz,
+    // dropping whatever left it, and plans this frame's bakes: up to about
+    // budget texels next to what is baked already, starting around the
+    // given world xz (the camera). The bakes are in texture texels, split
+    // where they wrap around, and must be rendered before the texture is
+    // read.
+    //
+    void Update(float originX, float originZ, float focusX, float focusZ,
+                int budget, std::vector<Rect>* bakes);
+
+    // Forces a bake from scratch, e.g. after the terrain's shader was
+    // reloaded.
+    void Invalidate() { _valid = false; }
+
+    GLuint GetTexture() const { return _texture; }
+    int GetSize() const { return _size; }
+
+    // World texels baked, including this frame's bakes; empty until the
+    // first Update.
+    Rect const & GetBaked() const { return _baked; }
+
+private:
+    void _Bake(Rect const & world, std::vector<Rect>* bakes) const;
+
+    GLuint _texture;
+    int _size;
+    float _texelSize;
+    Rect _baked;
+    bool _valid;
+};
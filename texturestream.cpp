@@ -0,0 +1,319 @@
+// Created by Jeremy Cowles, 2015
+
+#include "texturestream.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// A PNG signature plus the IHDR chunk, all lodepng_inspect needs
+static const size_t _HeaderSize = 33;
+
+struct _Format {
+    LodePNGColorType colorType;
+    GLenum internalFormat;
+    GLenum format;
+    unsigned channels;
+};
+
+static const _Format _formats[] = {
+    { LCT_GREY, GL_R8,      GL_RED,     1 },
+    { LCT_RGB,  GL_RGB8,    GL_RGB,     3 },
+    { LCT_RGBA, GL_RGBA8,   GL_RGBA,    4 },
+};
+
+static _Format const *
+_GetFormat(LodePNGColorType colorType)
+{
+    for (size_t i = 0; i < sizeof(_formats) / sizeof(_formats[0]); i++) {
+        if (_formats[i].colorType == colorType)
+            return &_formats[i];
+    }
+    return NULL;
+}
+
+static bool
+_Inspect(std::string const & path, AssetArchive::Span const & png,
+         unsigned* width, unsigned* height)
+{
+    unsigned char buffer[_HeaderSize];
+    unsigned char const* header = png.data;
+    size_t size = png.size;
+    if (not header) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (not file)
+            return false;
+        size = fread(buffer, 1, _HeaderSize, file);
+        fclose(file);
+        header = buffer;
+    }
+
+    LodePNGState state;
+    lodepng_state_init(&state);
+    unsigned error = lodepng_inspect(width, height, &state, header, size);
+    lodepng_state_cleanup(&state);
+    if (error) {
+        std::cerr << path << ": " << lodepng_error_text(error) << "\n";
+        return false;
+    }
+    return true;
+}
+
+TextureStreamer::TextureStreamer() :
+    _archive(NULL),
+    _stop(false)
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    // Without a context, only the threads can be cleaned up here
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _queue.clear();
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _workers.size(); i++)
+        _workers[i].join();
+}
+
+void
+TextureStreamer::Start(int workers)
+{
+    _stop = false;
+    for (int i = 0; i < std::max(workers, 1); i++)
+        _workers.push_back(std::thread(&TextureStreamer::_Run, this));
+}
+
+void
+TextureStreamer::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _queue.clear();
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _workers.size(); i++)
+        _workers[i].join();
+    _workers.clear();
+
+    for (size_t i = 0; i < _loads.size(); i++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _loads[i]->pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glDeleteBuffers(1, &_loads[i]->pbo);
+        delete _loads[i];
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    _loads.clear();
+}
+
+GLuint
+TextureStreamer::Load(std::string const & path, LodePNGColorType colorType,
+                      GLenum filter, GLenum wrap)
+{
+    TraceScope scope("texture load");
+
+    _Format const * format = _GetFormat(colorType);
+    if (not format)
+        return 0;
+
+    unsigned width = 0, height = 0;
+    AssetArchive::Span texels = { NULL, 0 };
+    AssetArchive::Span png = { NULL, 0 };
+    if (_archive and not _archive->FindTexels(path, format->channels, &width,
+                                              &height, &texels))
+        _archive->Find(path, &png);
+    if (not texels.data and not _Inspect(path, png, &width, &height))
+        return 0;
+
+    GLint prevTexture = 0, prevUnpack = 0, prevAlignment = 4;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+    glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &prevUnpack);
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &prevAlignment);
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    if (GLEW_ARB_texture_storage) {
+        glTexStorage2D(GL_TEXTURE_2D, 1, format->internalFormat, width,
+                       height);
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, format->internalFormat, width, height,
+                     0, format->format, GL_UNSIGNED_BYTE, NULL);
+    }
+
+    // Nothing left to do off the render thread; the driver's copy out of
+    // the mapping is all the work there is.
+    if (texels.data) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                        format->format, GL_UNSIGNED_BYTE, texels.data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, prevAlignment);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, prevUnpack);
+        glBindTexture(GL_TEXTURE_2D, prevTexture);
+        return texture;
+    }
+    glBindTexture(GL_TEXTURE_2D, prevTexture);
+
+    // Staging memory the worker decodes into; invalidating skips any wait
+    // on the buffer's (nonexistent) previous contents.
+    GLsizeiptr size = GLsizeiptr(width) * height * format->channels;
+    GLuint pbo = 0;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                    GL_MAP_WRITE_BIT
+                                    | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, prevUnpack);
+    if (not mapped) {
+        std::cerr << path << ": failed to map the upload buffer\n";
+        glDeleteBuffers(1, &pbo);
+        glDeleteTextures(1, &texture);
+        return 0;
+    }
+
+    _Load* load = new _Load;
+    load->path = path;
+    load->colorType = colorType;
+    load->png = png;
+    load->width = width;
+    load->height = height;
+    load->texture = texture;
+    load->pbo = pbo;
+    load->mapped = mapped;
+    load->decoded = false;
+    load->failed = false;
+    _loads.push_back(load);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(load);
+    }
+    _wake.notify_one();
+    return texture;
+}
+
+void
+TextureStreamer::Update()
+{
+    if (_loads.empty())
+        return;
+
+    std::vector<_Load*> finished;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _loads.size(); ) {
+            if (_loads[i]->decoded) {
+                finished.push_back(_loads[i]);
+                _loads.erase(_loads.begin() + i);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < finished.size(); i++) {
+        _Upload(finished[i]);
+        delete finished[i];
+    }
+}
+
+void
+TextureStreamer::_Upload(_Load* load)
+{
+    TraceScope scope("texture upload");
+
+    GLint prevUnpack = 0;
+    glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &prevUnpack);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, load->pbo);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    if (not load->failed) {
+        _Format const * format = _GetFormat(load->colorType);
+        GLint prevTexture = 0, prevAlignment = 4;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &prevAlignment);
+
+        // Rows are tightly packed, whatever their width
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, load->texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, load->width, load->height,
+                        format->format, GL_UNSIGNED_BYTE, (void*)0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, prevAlignment);
+        glBindTexture(GL_TEXTURE_2D, prevTexture);
+    }
+
+    // GL keeps the buffer alive until the copy out of it is done
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, prevUnpack);
+    glDeleteBuffers(1, &load->pbo);
+}
+
+void
+TextureStreamer::_Run()
+{
+    SetTraceThreadName("texture worker");
+    for (;;) {
+        _Load* load = NULL;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this]() {
+                return _stop or not _queue.empty();
+            });
+            if (_stop)
+                return;
+            load = _queue.front();
+            _queue.pop_front();
+        }
+
+        _Decode(load);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        load->decoded = true;
+    }
+}
+
+void
+TextureStreamer::_Decode(_Load* load)
+{
+    TraceScope scope("texture decode");
+
+    std::vector<unsigned char> file;
+    AssetArchive::Span png = load->png;
+    if (not png.data) {
+        lodepng::load_file(file, load->path);
+        png.data = file.empty() ? NULL : &file[0];
+        png.size = file.size();
+    }
+
+    std::vector<unsigned char> pixels;
+    unsigned width = 0, height = 0;
+    unsigned error = lodepng::decode(pixels, width, height, png.data,
+                                     png.size, load->colorType, 8);
+    if (error) {
+        std::cerr << "decoder error " << error << ": "
+                  << lodepng_error_text(error) << std::endl;
+        load->failed = true;
+        return;
+    }
+
+    // The file changed since it was inspected
+    if (width != load->width or height != load->height) {
+        std::cerr << load->path << ": size changed while loading\n";
+        load->failed = true;
+        return;
+    }
+
+    memcpy(load->mapped, &pixels[0], pixels.size());
+}
@@ -0,0 +1,99 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include "archive.h"
+
+#include "lodepng/lodepng.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Loads PNG textures without making the render thread wait on decoding or
+// uploads.
+//
+// Load only reads the PNG header (lodepng_inspect), so the texture's
+// immutable storage and a pixel buffer object of the right size exist
+// immediately; the buffer is mapped and a worker from a small pool decodes
+// straight into it. Update, once per frame on the render thread, unmaps the
+// finished buffers and copies them into their textures from the PBO, which
+// the driver does asynchronously rather than inside the call.
+//
+// With an asset archive, pre-decoded texels skip all of that and are
+// uploaded straight from the mapping during Load, and archived PNGs are
+// inspected and decoded in place rather than read from disk.
+//
+// Until its upload has happened a texture's contents are undefined; use
+// IsBusy to wait for everything in flight, e.g. at the end of start-up.
+//
+class TextureStreamer
+{
+public:
+    TextureStreamer();
+    ~TextureStreamer();
+
+    // Starts the decode workers.
+    void Start(int workers);
+
+    // Assets are looked up here before falling back to loose files, NULL
+    // for none. The archive must stay open until Stop.
+    void SetArchive(AssetArchive const* archive) { _archive = archive; }
+
+    // Drops pending decodes and joins the workers; requires the GL context
+    // Load was called on.
+    void Stop();
+
+    //
+    // Allocates the texture from the PNG's header and queues the decode.
+    // colorType is the decoded layout (LCT_GREY, LCT_RGB or LCT_RGBA, 8 bits
+    // per channel), filter and wrap apply to both directions. Returns 0 if
+    // the file can't be read or isn't a PNG.
+    //
+    // Neither this nor Update disturb the texture and pixel unpack buffer
+    // bindings or the unpack alignment, so they are safe to call mid-frame.
+    //
+    GLuint Load(std::string const & path, LodePNGColorType colorType,
+                GLenum filter, GLenum wrap);
+
+    // Uploads whatever finished decoding, render thread only.
+    void Update();
+
+    // True while any load has not been uploaded yet.
+    bool IsBusy() const { return not _loads.empty(); }
+
+private:
+    struct _Load {
+        std::string path;
+        LodePNGColorType colorType;
+        AssetArchive::Span png; // data is NULL when loading from disk
+        unsigned width;
+        unsigned height;
+        GLuint texture;
+        GLuint pbo;
+        void* mapped;           // written by a worker while queued
+        bool decoded;
+        bool failed;
+    };
+
+    void _Run();
+    void _Decode(_Load* load);
+    void _Upload(_Load* load);
+
+    AssetArchive const* _archive;
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::deque<_Load*> _queue;  // not yet picked up by a worker
+    bool _stop;
+
+    // Render thread only, in Load order
+    std::deque<_Load*> _loads;
+};
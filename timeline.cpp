@@ -0,0 +1,84 @@
+// Created by Jeremy Cowles, 2015
+
+#include "timeline.h"
+
+#include <cmath>
+#include <stdint.h>
+
+//
+// Seeds come from the time rounded to microseconds rather than from the
+// frame count, so scrubbing back to a time reproduces its frame exactly.
+// The finalizer of MurmurHash3 spreads nearby times over the whole range.
+//
+static unsigned
+_SeedFromTime(double seconds)
+{
+    uint64_t x = uint64_t(int64_t(std::floor(seconds*1e6 + 0.5)));
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return unsigned(x);
+}
+
+Timeline::Timeline() :
+    _mode(RealTime),
+    _fps(60.0),
+    _base(0.0),
+    _anchor(_Clock::now()),
+    _anchorFrame(0),
+    _frame(0),
+    _seeked(true)
+{
+}
+
+double
+Timeline::_Now() const
+{
+    switch (_mode) {
+    case RealTime:
+        return _base + std::chrono::duration<double>(
+            _Clock::now() - _anchor).count();
+    case FixedStep:
+        return _base + (_frame - _anchorFrame) / _fps;
+    case Scrub:
+        break;
+    }
+    return _base;
+}
+
+void
+Timeline::SetMode(Mode mode)
+{
+    if (mode == _mode)
+        return;
+    // Carry on from wherever the old mode was, without a jump.
+    double now = _Now();
+    _mode = mode;
+    _base = now;
+    _anchor = _Clock::now();
+    _anchorFrame = _frame;
+}
+
+void
+Timeline::Seek(double seconds)
+{
+    _base = seconds < 0 ? 0 : seconds;
+    _anchor = _Clock::now();
+    _anchorFrame = _frame;
+    _seeked = true;
+}
+
+Timeline::Sample
+Timeline::Advance()
+{
+    Sample sample;
+    sample.frame = _frame;
+    sample.time = _Now();
+    sample.seed = _SeedFromTime(sample.time);
+    sample.seeked = _seeked;
+    _seeked = false;
+    _frame++;
+    return sample;
+}
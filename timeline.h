@@ -0,0 +1,66 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+//
+// The single source of demo time.
+//
+// The clock is sampled exactly once per frame and everything time dependent
+// in that frame (shader time, audio signals, the random seed) is derived
+// from the sample, so two runs that produce the same samples render the same
+// images.
+//
+//   RealTime   follows the wall clock, for watching the demo
+//   FixedStep  advances by exactly 1/fps per frame, for renders and
+//              benchmarks; frame N is always at start + N/fps
+//   Scrub      holds still, time only moves through Seek and Nudge
+//
+class Timeline
+{
+public:
+    enum Mode { RealTime, FixedStep, Scrub };
+
+    struct Sample {
+        size_t frame;           // frames sampled so far, not reset by seeks
+        double time;            // demo time in seconds
+        unsigned seed;          // a function of time only
+        bool seeked;            // time jumped since the previous sample
+    };
+
+    Timeline();
+
+    void SetMode(Mode mode);
+    Mode GetMode() const { return _mode; }
+
+    // The step used by FixedStep mode.
+    void SetFps(double fps) { _fps = fps; }
+
+    // Jumps to the given time, in any mode.
+    void Seek(double seconds);
+
+    // Moves the current time by the given amount, in any mode.
+    void Nudge(double seconds) { Seek(_Now() + seconds); }
+
+    // Call once per frame.
+    Sample Advance();
+
+private:
+    typedef std::chrono::steady_clock _Clock;
+
+    double _Now() const;
+
+    Mode _mode;
+    double _fps;
+
+    // Demo time at _anchor (RealTime) or at _anchorFrame (FixedStep), or
+    // simply the current time (Scrub).
+    double _base;
+    _Clock::time_point _anchor;
+    size_t _anchorFrame;
+
+    size_t _frame;
+    bool _seeked;
+};
@@ -0,0 +1,158 @@
+// Created by Jeremy Cowles, 2015
+
+//
+// Builds an AssetArchive (see archive.h) from loose files:
+//
+//   pack assets.pak quad.vs.glsl dunes.fs.glsl tex12.png:grey audio.ogg
+//
+// Every file is stored as is; a PNG named with a :grey, :rgb or :rgba
+// suffix additionally gets its texels decoded into the archive in that
+// layout, which is what the demo looks for before decoding the PNG itself.
+//
+
+#include "archive.h"
+
+#include "lodepng/lodepng.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct _Input {
+    AssetArchive::Entry entry;
+    std::vector<unsigned char> data;
+};
+
+static bool
+_ParseChannels(std::string const & suffix, LodePNGColorType* colorType,
+               unsigned* channels)
+{
+    if (suffix == "grey") {
+        *colorType = LCT_GREY;
+        *channels = 1;
+    } else if (suffix == "rgb") {
+        *colorType = LCT_RGB;
+        *channels = 3;
+    } else if (suffix == "rgba") {
+        *colorType = LCT_RGBA;
+        *channels = 4;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void
+_InitEntry(std::string const & name, AssetArchive::Kind kind,
+           AssetArchive::Entry* entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    strncpy(entry->name, name.c_str(), sizeof(entry->name) - 1);
+    entry->kind = kind;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " OUT.pak FILE[:grey|:rgb|:rgba]...\n";
+        return EXIT_FAILURE;
+    }
+
+    std::vector<_Input> inputs;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string path = arg, suffix;
+        size_t colon = arg.rfind(':');
+        if (colon != std::string::npos) {
+            path = arg.substr(0, colon);
+            suffix = arg.substr(colon + 1);
+        }
+        if (path.size() >= sizeof(AssetArchive::Entry().name)) {
+            std::cerr << path << ": name too long\n";
+            return EXIT_FAILURE;
+        }
+
+        _Input raw;
+        _InitEntry(path, AssetArchive::Raw, &raw.entry);
+        lodepng::load_file(raw.data, path);
+        if (raw.data.empty()) {
+            std::cerr << path << ": missing or empty\n";
+            return EXIT_FAILURE;
+        }
+        raw.entry.size = raw.data.size();
+        inputs.push_back(raw);
+
+        if (suffix.empty())
+            continue;
+
+        LodePNGColorType colorType;
+        unsigned channels = 0;
+        if (not _ParseChannels(suffix, &colorType, &channels)) {
+            std::cerr << arg << ": unknown texel layout " << suffix << "\n";
+            return EXIT_FAILURE;
+        }
+        _Input texels;
+        _InitEntry(path, AssetArchive::Texels, &texels.entry);
+        unsigned width = 0, height = 0;
+        unsigned error = lodepng::decode(texels.data, width, height,
+                                         raw.data, colorType, 8);
+        if (error) {
+            std::cerr << path << ": " << lodepng_error_text(error) << "\n";
+            return EXIT_FAILURE;
+        }
+        texels.entry.channels = channels;
+        texels.entry.width = width;
+        texels.entry.height = height;
+        texels.entry.size = texels.data.size();
+        inputs.push_back(texels);
+    }
+
+    // Lay the data out after the index, each entry aligned and terminated
+    AssetArchive::Header header;
+    memcpy(header.magic, AssetArchive::Magic, sizeof(header.magic));
+    header.count = uint32_t(inputs.size());
+    header.reserved = 0;
+
+    uint64_t offset = sizeof(header) + inputs.size()
+                    * sizeof(AssetArchive::Entry);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        offset = (offset + AssetArchive::Alignment - 1)
+               & ~uint64_t(AssetArchive::Alignment - 1);
+        inputs[i].entry.offset = offset;
+        offset += inputs[i].entry.size + 1;
+    }
+
+    FILE* file = fopen(argv[1], "wb");
+    if (not file) {
+        std::cerr << "Failed to open " << argv[1] << "\n";
+        return EXIT_FAILURE;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; ok and i < inputs.size(); i++)
+        ok = fwrite(&inputs[i].entry, sizeof(AssetArchive::Entry), 1, file) == 1;
+
+    static const char zeros[AssetArchive::Alignment] = { 0 };
+    uint64_t written = sizeof(header) + inputs.size()
+                     * sizeof(AssetArchive::Entry);
+    for (size_t i = 0; ok and i < inputs.size(); i++) {
+        _Input const & input = inputs[i];
+        size_t pad = size_t(input.entry.offset - written);
+        ok = fwrite(zeros, 1, pad, file) == pad
+            and fwrite(&input.data[0], 1, input.data.size(), file)
+                == input.data.size()
+            and fwrite(zeros, 1, 1, file) == 1;
+        written = input.entry.offset + input.entry.size + 1;
+    }
+    if (fclose(file) != 0 or not ok) {
+        std::cerr << "Failed to write " << argv[1] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Packed " << inputs.size() << " entries ("
+              << written << " bytes) into " << argv[1] << "\n";
+    return EXIT_SUCCESS;
+}
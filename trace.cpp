@@ -0,0 +1,296 @@
+// Created by Jeremy Cowles, 2015
+
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+    struct _Event {
+        char const* name;
+        long long start;        // us since StartTrace
+        long long duration;
+        int track;
+        long frame;
+    };
+
+    struct _GpuScope {
+        char const* name;
+        GLuint queries[2];
+        bool ended;
+        long frame;
+    };
+
+    typedef std::chrono::steady_clock _Clock;
+}
+
+// The GPU track id, below any thread's
+static const int _GpuTrack = 0;
+
+static std::atomic<bool> _recording(false);
+static bool _started = false;
+static std::string _path;
+static _Clock::time_point _epoch;
+
+// Guards everything below, scopes may close on any thread
+static std::mutex _mutex;
+static std::vector<_Event> _events;
+static std::map<std::thread::id, int> _tracks;
+static std::map<int, std::string> _trackNames;
+
+// GL thread only
+static std::deque<_GpuScope> _gpuScopes;
+static long long _gpuResolved = 0;      // scopes popped off the front
+static std::vector<GLuint> _freeQueries;
+static long long _gpuOffset = 0;        // ns to add to GPU time for CPU time
+static bool _calibrated = false;
+static long _currentFrame = -1;
+
+static long long
+_Now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        _Clock::now() - _epoch).count();
+}
+
+// Call with _mutex held.
+static int
+_GetTrack()
+{
+    std::thread::id id = std::this_thread::get_id();
+    std::map<std::thread::id, int>::iterator it = _tracks.find(id);
+    if (it != _tracks.end())
+        return it->second;
+    int track = int(_tracks.size()) + 1;
+    _tracks[id] = track;
+    return track;
+}
+
+static void
+_Record(char const* name, long long start, long long duration, int track,
+        long frame)
+{
+    _Event event = { name, start, duration, track, frame };
+    _events.push_back(event);
+}
+
+//
+// GL_TIMESTAMP counts nanoseconds from an arbitrary origin; reading it once
+// alongside the CPU clock gives the offset that lines both up. Queued work
+// makes the GPU scopes land a little later than the CPU issued them, which
+// is exactly what the trace should show.
+//
+static void
+_Calibrate()
+{
+    GLint64 gpuNow = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    _gpuOffset = _Now() * 1000 - gpuNow;
+    _calibrated = true;
+}
+
+static GLuint
+_GetQuery()
+{
+    if (_freeQueries.empty()) {
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        return query;
+    }
+    GLuint query = _freeQueries.back();
+    _freeQueries.pop_back();
+    return query;
+}
+
+//
+// Resolves finished GPU scopes, oldest first; queries complete in order so
+// the first one still pending ends the sweep unless wait is set.
+//
+static void
+_ResolveGpu(bool wait)
+{
+    while (not _gpuScopes.empty()) {
+        _GpuScope & scope = _gpuScopes.front();
+        if (not scope.ended)
+            break;
+
+        if (not wait) {
+            GLint available = 0;
+            glGetQueryObjectiv(scope.queries[1], GL_QUERY_RESULT_AVAILABLE,
+                               &available);
+            if (not available)
+                break;
+        }
+
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(scope.queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(scope.queries[1], GL_QUERY_RESULT, &end);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _Record(scope.name, ((long long)begin + _gpuOffset) / 1000,
+                    (long long)(end - begin) / 1000, _GpuTrack, scope.frame);
+        }
+
+        _freeQueries.push_back(scope.queries[0]);
+        _freeQueries.push_back(scope.queries[1]);
+        _gpuScopes.pop_front();
+        _gpuResolved++;
+    }
+}
+
+static void
+_WriteEscaped(FILE* file, char const* str)
+{
+    for (; *str; str++) {
+        if (*str == '"' or *str == '\\')
+            fputc('\\', file);
+        fputc(*str, file);
+    }
+}
+
+static bool
+_Write(std::string const & path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (not file)
+        return false;
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    fprintf(file, "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, "
+                  "\"tid\": %d, \"args\": {\"name\": \"GPU\"}}",
+            _GpuTrack);
+    for (std::map<std::thread::id, int>::const_iterator it = _tracks.begin();
+         it != _tracks.end(); ++it) {
+        std::map<int, std::string>::const_iterator name =
+            _trackNames.find(it->second);
+        fprintf(file, ",\n{\"ph\": \"M\", \"name\": \"thread_name\", "
+                      "\"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"",
+                it->second);
+        if (name != _trackNames.end())
+            _WriteEscaped(file, name->second.c_str());
+        else
+            fprintf(file, "thread %d", it->second);
+        fprintf(file, "\"}}");
+    }
+
+    for (size_t i = 0; i < _events.size(); i++) {
+        _Event const & event = _events[i];
+        fprintf(file, ",\n{\"ph\": \"X\", \"name\": \"");
+        _WriteEscaped(file, event.name);
+        fprintf(file, "\", \"pid\": 1, \"tid\": %d, \"ts\": %lld, "
+                      "\"dur\": %lld",
+                event.track, event.start, event.duration);
+        if (event.frame >= 0)
+            fprintf(file, ", \"args\": {\"frame\": %ld}", event.frame);
+        fprintf(file, "}");
+    }
+
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+void
+StartTrace(std::string const & path)
+{
+    _path = path;
+    _epoch = _Clock::now();
+    _started = true;
+    _recording = true;
+}
+
+void
+StopTrace()
+{
+    if (not _started)
+        return;
+    _recording = false;
+    _started = false;
+
+    _ResolveGpu(true);
+    for (size_t i = 0; i < _freeQueries.size(); i++)
+        glDeleteQueries(1, &_freeQueries[i]);
+    _freeQueries.clear();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_Write(_path)) {
+        std::cout << "Wrote " << _events.size() << " trace events to "
+                  << _path << "\n";
+    } else {
+        std::cerr << "Failed to write trace " << _path << "\n";
+    }
+    _events.clear();
+}
+
+void
+SetTraceRecording(bool recording)
+{
+    _recording = _started and recording;
+}
+
+void
+SetTraceThreadName(char const* name)
+{
+    if (not _started)
+        return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _trackNames[_GetTrack()] = name;
+}
+
+void
+PollTraceGpu()
+{
+    if (not _gpuScopes.empty())
+        _ResolveGpu(false);
+}
+
+TraceScope::TraceScope(char const* name, long frame) :
+    _name(name),
+    _frame(frame),
+    _start(_recording ? _Now() : -1)
+{
+    if (_start >= 0 and frame >= 0)
+        _currentFrame = frame;
+}
+
+TraceScope::~TraceScope()
+{
+    if (_start < 0)
+        return;
+    long long end = _Now();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _Record(_name, _start, end - _start, _GetTrack(), _frame);
+}
+
+TraceGpuScope::TraceGpuScope(char const* name) :
+    _pending(-1)
+{
+    if (not _recording)
+        return;
+    if (not _calibrated)
+        _Calibrate();
+
+    _GpuScope scope = { name, { _GetQuery(), _GetQuery() }, false,
+                        _currentFrame };
+    glQueryCounter(scope.queries[0], GL_TIMESTAMP);
+    _gpuScopes.push_back(scope);
+    _pending = _gpuResolved + (long long)_gpuScopes.size() - 1;
+}
+
+TraceGpuScope::~TraceGpuScope()
+{
+    if (_pending < 0)
+        return;
+    _GpuScope & scope = _gpuScopes[size_t(_pending - _gpuResolved)];
+    glQueryCounter(scope.queries[1], GL_TIMESTAMP);
+    scope.ended = true;
+}
@@ -0,0 +1,58 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+
+//
+// A lightweight tracer writing Chrome trace_event JSON (load it in
+// chrome://tracing or Perfetto).
+//
+// Scopes are RAII objects and nest naturally; each thread gets its own
+// track. GPU scopes bracket GL commands with timestamp queries, which are
+// resolved a few frames later without stalling and drawn on a separate
+// "GPU" track, shifted onto the CPU clock.
+//
+// Recording is on from StartTrace, so start-up is always captured, and can
+// then be switched per frame. When no trace was started every call is a
+// cheap no-op.
+//
+void StartTrace(std::string const & path);
+
+// Resolves the remaining GPU scopes (waiting on them) and writes the file;
+// needs the context that recorded the GPU scopes to be current.
+void StopTrace();
+
+void SetTraceRecording(bool recording);
+
+// Names the calling thread's track.
+void SetTraceThreadName(char const* name);
+
+// Collects finished GPU scopes, call once per frame on the GL thread.
+void PollTraceGpu();
+
+class TraceScope
+{
+public:
+    // Names must outlive the trace, i.e. be string literals. frame, when
+    // not negative, is recorded as an argument.
+    explicit TraceScope(char const* name, long frame = -1);
+    ~TraceScope();
+
+private:
+    char const* _name;
+    long _frame;
+    long long _start;
+};
+
+class TraceGpuScope
+{
+public:
+    explicit TraceGpuScope(char const* name);
+    ~TraceGpuScope();
+
+private:
+    long long _pending;     // sequence number of the open scope, or -1
+};
@@ -0,0 +1,93 @@
+// Created by Jeremy Cowles, 2015
+
+#include "uniformring.h"
+
+#include <cstdlib>
+#include <iostream>
+
+UniformRing::UniformRing() :
+    _buffer(0),
+    _blockSize(0),
+    _stride(0),
+    _persistent(false),
+    _mapped(NULL),
+    _current(NULL),
+    _slot(0)
+{
+    for (int i = 0; i < Depth; i++)
+        _fences[i] = 0;
+}
+
+void
+UniformRing::Init(GLsizeiptr blockSize)
+{
+    // Every slot must start on a valid glBindBufferRange offset.
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    _blockSize = blockSize;
+    _stride = (blockSize + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+
+    _persistent = GLEW_ARB_buffer_storage;
+    if (_persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT
+                         | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, _stride*Depth, NULL, flags);
+        _mapped = (char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0,
+                                          _stride*Depth, flags);
+        if (not _mapped) {
+            std::cerr << "Failed to map uniform ring\n";
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        glBufferData(GL_UNIFORM_BUFFER, _stride*Depth, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void*
+UniformRing::BeginFrame()
+{
+    if (GLsync fence = _fences[_slot]) {
+        // Flush on the first wait so the fence can actually signal.
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+            flags = 0;
+        glDeleteSync(fence);
+        _fences[_slot] = 0;
+    }
+
+    if (_persistent) {
+        _current = _mapped + _stride*_slot;
+    } else {
+        glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+        _current = glMapBufferRange(GL_UNIFORM_BUFFER, _stride*_slot,
+                                    _blockSize,
+                                    GL_MAP_WRITE_BIT
+                                    | GL_MAP_INVALIDATE_RANGE_BIT
+                                    | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+    return _current;
+}
+
+void
+UniformRing::Bind(GLuint bindingPoint)
+{
+    if (not _persistent) {
+        glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    glBindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, _buffer,
+                      _stride*_slot, _blockSize);
+}
+
+void
+UniformRing::EndFrame()
+{
+    _fences[_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _slot = (_slot + 1) % Depth;
+    _current = NULL;
+}
@@ -0,0 +1,50 @@
+// Created by Jeremy Cowles, 2015
+
+#pragma once
+
+#include <GL/glew.h>
+
+//
+// A uniform buffer holding one block per frame in flight.
+//
+// Each frame writes its block into the next slot of the ring and fences it
+// once the frame's draws are submitted, so the CPU never overwrites data the
+// GPU may still be reading and never has to wait unless it gets a whole ring
+// ahead. With ARB_buffer_storage the buffer is mapped once, persistently and
+// coherently; otherwise each slot is mapped unsynchronized per frame, which
+// the fences make safe.
+//
+class UniformRing
+{
+public:
+    static const int Depth = 3;
+
+    UniformRing();
+
+    // Allocates the buffer, requires a current GL context.
+    void Init(GLsizeiptr blockSize);
+
+    //
+    // Returns a pointer to this frame's block, waiting on its fence first in
+    // the (rare) case the GPU is still using it. The block must be fully
+    // rewritten, its previous contents are undefined.
+    //
+    void* BeginFrame();
+
+    // Makes the block written since BeginFrame visible at the given uniform
+    // buffer binding point.
+    void Bind(GLuint bindingPoint);
+
+    // Fences the block, call after the last draw that reads it.
+    void EndFrame();
+
+private:
+    GLuint _buffer;
+    GLsizeiptr _blockSize;
+    GLsizeiptr _stride;
+    bool _persistent;
+    char* _mapped;
+    void* _current;
+    GLsync _fences[Depth];
+    int _slot;
+};